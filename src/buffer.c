@@ -51,7 +51,10 @@ VAStatus RequestCreateBuffer(VADriverContextP context, VAContextID context_id,
 {
 	struct request_data *driver_data = context->pDriverData;
 	struct object_buffer *buffer_object = NULL;
-	void *buffer_data;
+	struct object_context *context_object;
+	void *buffer_data = NULL;
+	unsigned int slice_offset = 0;
+	int slice_buffer = -1;
 	VAStatus status;
 	VABufferID id;
 
@@ -75,10 +78,26 @@ VAStatus RequestCreateBuffer(VADriverContextP context, VAContextID context_id,
 		goto error;
 	}
 
-	buffer_data = malloc(size * count);
+	context_object = CONTEXT(driver_data, context_id);
+
+	if (type == VASliceDataBufferType && context_object != NULL &&
+	    context_object->slices_zero_copy) {
+		status = context_slice_carve(driver_data, context_object,
+					     size * count, &slice_buffer,
+					     &slice_offset);
+		if (status == VA_STATUS_SUCCESS)
+			buffer_data = (char *)context_object->slice_buffers[slice_buffer].data +
+				      slice_offset;
+		else
+			slice_buffer = -1;
+	}
+
 	if (buffer_data == NULL) {
-		status = VA_STATUS_ERROR_ALLOCATION_FAILED;
-		goto error;
+		buffer_data = malloc(size * count);
+		if (buffer_data == NULL) {
+			status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+			goto error;
+		}
 	}
 
 	if (data != NULL)
@@ -89,6 +108,9 @@ VAStatus RequestCreateBuffer(VADriverContextP context, VAContextID context_id,
 	buffer_object->count = count;
 	buffer_object->data = buffer_data;
 	buffer_object->size = size;
+	buffer_object->context_id = context_id;
+	buffer_object->slice_buffer = slice_buffer;
+	buffer_object->slice_offset = slice_offset;
 
 	buffer_object->derived_surface_id = VA_INVALID_ID;
 	buffer_object->info.handle = (uintptr_t) -1;
@@ -116,7 +138,7 @@ VAStatus RequestDestroyBuffer(VADriverContextP context, VABufferID buffer_id)
 	if (buffer_object == NULL)
 		return VA_STATUS_ERROR_INVALID_BUFFER;
 
-	if (buffer_object->data != NULL)
+	if (buffer_object->data != NULL && buffer_object->slice_buffer < 0)
 		free(buffer_object->data);
 
 	object_heap_free(&driver_data->buffer_heap,
@@ -46,6 +46,11 @@ struct object_buffer {
 	void *data;
 	unsigned int size;
 
+	/* Slice buffer of the context the data was carved from, if any. */
+	VAContextID context_id;
+	int slice_buffer;
+	unsigned int slice_offset;
+
 	VASurfaceID derived_surface_id;
 	VABufferInfo info;
 };
@@ -24,13 +24,16 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include "buffer.h"
 #include "context.h"
 #include "config.h"
+#include "control.h"
 #include "request.h"
 #include "surface.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <assert.h>
 
@@ -43,11 +46,761 @@
 #include <h264-ctrls.h>
 #include <hevc-ctrls.h>
 
+#include "dma_heap.h"
 #include "utils.h"
 #include "v4l2.h"
 
 #include "autoconfig.h"
 
+/*
+ * Low-latency use cases want a single request in flight, while throughput
+ * benefits from deeper queues. There is no standard config attribute for
+ * this, so it is picked from the environment and bounded by the number of
+ * surfaces, that can't all be in flight at once. Each request in flight
+ * holds a source OUTPUT buffer, so the default stays moderate.
+ */
+static unsigned int context_queue_depth(int surfaces_count)
+{
+	unsigned int depth = CONTEXT_QUEUE_DEPTH_DEFAULT;
+	char *value;
+
+	value = getenv("LIBVA_V4L2_REQUEST_QUEUE_DEPTH");
+	if (value != NULL && atoi(value) > 0)
+		depth = atoi(value);
+
+	if (surfaces_count > 0 && depth > (unsigned int)surfaces_count)
+		depth = surfaces_count;
+
+	if (depth > VIDEO_MAX_FRAME)
+		depth = VIDEO_MAX_FRAME;
+
+	return depth;
+}
+
+/*
+ * Slices can only be submitted on their own when the driver holds the
+ * capture buffer between requests. Only H.264 is handled, since the other
+ * codecs either have a single slice or need the whole picture data. Drivers
+ * that only decode single slices get it without asking.
+ */
+static bool context_slices_submit_supported(struct request_data *driver_data,
+					    struct object_context *context_object,
+					    VAProfile profile,
+					    unsigned int output_type)
+{
+	unsigned int capabilities;
+	int rc;
+
+	switch (context_object->decode_mode) {
+	case CONTEXT_DECODE_MODE_SLICE_BASED:
+		break;
+
+	case CONTEXT_DECODE_MODE_FRAME_BASED:
+		return false;
+
+	default:
+		if (getenv("LIBVA_V4L2_REQUEST_SLICE_SUBMIT") == NULL)
+			return false;
+		break;
+	}
+
+	/* Start codes are only inserted when copying whole pictures. */
+	if (context_object->start_codes)
+		return false;
+
+	switch (profile) {
+	case VAProfileH264Main:
+	case VAProfileH264High:
+	case VAProfileH264ConstrainedBaseline:
+	case VAProfileH264MultiviewHigh:
+	case VAProfileH264StereoHigh:
+	case VAProfileHEVCMain:
+		break;
+
+	default:
+		return false;
+	}
+
+	rc = v4l2_query_buffers_capabilities(driver_data->video_fd, output_type,
+					     &capabilities);
+	if (rc < 0)
+		return false;
+
+	return (capabilities & V4L2_BUF_CAP_SUPPORTS_M2M_HOLD_CAPTURE_BUF) != 0;
+}
+
+static bool context_slices_zero_copy_supported(struct object_context *context_object)
+{
+	/* Start codes are inserted while copying. */
+	if (context_object->start_codes)
+		return false;
+
+	return getenv("LIBVA_V4L2_REQUEST_ZERO_COPY") != NULL;
+}
+
+/*
+ * Decoding whole frames takes a single request and lets the driver deal with
+ * the slices, so it is preferred. Start codes are only used when the driver
+ * requires them, since they have to be inserted in the slice data.
+ */
+static void context_decode_mode_negotiate(struct request_data *driver_data,
+					  struct object_context *context_object,
+					  VAProfile profile)
+{
+	struct control_info *control;
+	unsigned int mode_id, start_code_id;
+	unsigned int modes, start_codes;
+	int mode, start_code;
+	int rc;
+
+	context_object->decode_mode = CONTEXT_DECODE_MODE_ANY;
+	context_object->start_codes = false;
+
+	switch (profile) {
+	case VAProfileH264Main:
+	case VAProfileH264High:
+	case VAProfileH264ConstrainedBaseline:
+	case VAProfileH264MultiviewHigh:
+	case VAProfileH264StereoHigh:
+		mode_id = V4L2_CID_MPEG_VIDEO_H264_DECODE_MODE;
+		start_code_id = V4L2_CID_MPEG_VIDEO_H264_START_CODE;
+		break;
+
+	case VAProfileHEVCMain:
+		mode_id = V4L2_CID_MPEG_VIDEO_HEVC_DECODE_MODE;
+		start_code_id = V4L2_CID_MPEG_VIDEO_HEVC_START_CODE;
+		break;
+
+	default:
+		return;
+	}
+
+	/* The H.264 and HEVC menus share the same values. */
+	control = control_lookup(driver_data, mode_id);
+	modes = control != NULL ? control->menu_mask : 0;
+	if (modes != 0) {
+		if (modes & (1 << V4L2_MPEG_VIDEO_H264_DECODE_MODE_FRAME_BASED))
+			mode = V4L2_MPEG_VIDEO_H264_DECODE_MODE_FRAME_BASED;
+		else
+			mode = V4L2_MPEG_VIDEO_H264_DECODE_MODE_SLICE_BASED;
+
+		rc = v4l2_set_control_value(driver_data->video_fd, mode_id,
+					    mode);
+		if (rc == 0)
+			context_object->decode_mode =
+				mode == V4L2_MPEG_VIDEO_H264_DECODE_MODE_FRAME_BASED ?
+				CONTEXT_DECODE_MODE_FRAME_BASED :
+				CONTEXT_DECODE_MODE_SLICE_BASED;
+	}
+
+	control = control_lookup(driver_data, start_code_id);
+	start_codes = control != NULL ? control->menu_mask : 0;
+	if (start_codes != 0) {
+		if (start_codes & (1 << V4L2_MPEG_VIDEO_H264_START_CODE_NONE))
+			start_code = V4L2_MPEG_VIDEO_H264_START_CODE_NONE;
+		else
+			start_code = V4L2_MPEG_VIDEO_H264_START_CODE_ANNEX_B;
+
+		rc = v4l2_set_control_value(driver_data->video_fd,
+					    start_code_id, start_code);
+		if (rc == 0)
+			context_object->start_codes =
+				start_code == V4L2_MPEG_VIDEO_H264_START_CODE_ANNEX_B;
+	}
+}
+
+static unsigned int context_output_memory(struct request_data *driver_data,
+					  unsigned int output_type)
+{
+	unsigned int capabilities;
+	int rc;
+
+	if (driver_data->dma_heap_fd < 0)
+		return V4L2_MEMORY_MMAP;
+
+	rc = v4l2_query_buffers_capabilities(driver_data->video_fd, output_type,
+					     &capabilities);
+	if (rc < 0 || (capabilities & V4L2_BUF_CAP_SUPPORTS_DMABUF) == 0) {
+		request_log("Unable to import OUTPUT dmabufs, falling back to MMAP\n");
+		return V4L2_MEMORY_MMAP;
+	}
+
+	return V4L2_MEMORY_DMABUF;
+}
+
+static void context_output_buffers_destroy(struct context_output_buffer *buffers,
+					   unsigned int buffers_count)
+{
+	struct context_output_buffer *buffer;
+	unsigned int i;
+
+	for (i = 0; i < buffers_count; i++) {
+		buffer = &buffers[i];
+
+		if (buffer->request_fd >= 0)
+			close(buffer->request_fd);
+
+		if (buffer->data != NULL)
+			munmap(buffer->data, buffer->size);
+
+		if (buffer->fd >= 0)
+			close(buffer->fd);
+	}
+
+	free(buffers);
+}
+
+static void context_output_buffer_cpu_access(struct context_output_buffer *buffer,
+					     bool access)
+{
+	if (buffer->fd < 0 || buffer->cpu_access == access)
+		return;
+
+	dma_buf_sync(buffer->fd, access);
+	buffer->cpu_access = access;
+}
+
+/*
+ * OUTPUT dmabufs are mapped too, for the slice data to be copied in. They are
+ * returned open for CPU access.
+ */
+static int context_output_dmabuf_alloc(struct request_data *driver_data,
+				       unsigned int size, int *fd, void **data)
+{
+	void *dmabuf_data;
+	int dmabuf_fd;
+
+	dmabuf_fd = dma_heap_alloc(driver_data->dma_heap_fd, size);
+	if (dmabuf_fd < 0)
+		return -1;
+
+	dmabuf_data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   dmabuf_fd, 0);
+	if (dmabuf_data == MAP_FAILED) {
+		close(dmabuf_fd);
+		return -1;
+	}
+
+	dma_buf_sync(dmabuf_fd, true);
+
+	*fd = dmabuf_fd;
+	*data = dmabuf_data;
+
+	return 0;
+}
+
+static struct context_output_buffer *
+context_output_buffers_create(struct request_data *driver_data,
+			      unsigned int output_type,
+			      unsigned int buffers_count, unsigned int size)
+{
+	struct context_output_buffer *buffers;
+	struct context_output_buffer *buffer;
+	unsigned int index_base;
+	unsigned int length;
+	unsigned int offset;
+	unsigned int i;
+	void *data;
+	int rc;
+
+	rc = v4l2_create_buffers(driver_data->video_fd, output_type,
+				 driver_data->output_memory, buffers_count, 0,
+				 &index_base);
+	if (rc < 0)
+		return NULL;
+
+	buffers = calloc(buffers_count, sizeof(*buffers));
+	if (buffers == NULL)
+		return NULL;
+
+	for (i = 0; i < buffers_count; i++) {
+		buffer = &buffers[i];
+
+		buffer->index = index_base + i;
+		buffer->fd = -1;
+		buffer->request_fd = -1;
+		buffer->surface_id = VA_INVALID_ID;
+	}
+
+	for (i = 0; i < buffers_count; i++) {
+		buffer = &buffers[i];
+
+		if (driver_data->output_memory == V4L2_MEMORY_DMABUF) {
+			rc = context_output_dmabuf_alloc(driver_data, size,
+							 &buffer->fd,
+							 &buffer->data);
+			if (rc < 0)
+				goto error;
+
+			buffer->size = size;
+			buffer->cpu_access = true;
+			continue;
+		}
+
+		rc = v4l2_query_buffer(driver_data->video_fd, output_type,
+				       buffer->index, &length, &offset, 1);
+		if (rc < 0)
+			goto error;
+
+		data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+			    driver_data->video_fd, offset);
+		if (data == MAP_FAILED)
+			goto error;
+
+		buffer->data = data;
+		buffer->size = length;
+	}
+
+	return buffers;
+
+error:
+	context_output_buffers_destroy(buffers, buffers_count);
+
+	return NULL;
+}
+
+static void context_slice_buffers_destroy(struct object_context *context_object)
+{
+	context_output_buffers_destroy(context_object->slice_buffers,
+				       context_object->slice_buffers_count);
+
+	context_object->slice_buffers = NULL;
+	context_object->slice_buffers_count = 0;
+}
+
+static int context_slice_buffers_create(struct request_data *driver_data,
+					struct object_context *context_object,
+					unsigned int output_type)
+{
+	unsigned int count;
+
+	/* These come on top of the source OUTPUT buffers. */
+	if (context_object->source_buffers_count + 2 > VIDEO_MAX_FRAME)
+		return -1;
+
+	count = VIDEO_MAX_FRAME - context_object->source_buffers_count;
+	if (count > CONTEXT_SLICE_BUFFERS_MAX)
+		count = CONTEXT_SLICE_BUFFERS_MAX;
+
+	context_object->slice_buffers =
+		context_output_buffers_create(driver_data, output_type, count,
+					      context_object->source_size);
+	if (context_object->slice_buffers == NULL)
+		return -1;
+
+	context_object->slice_buffers_count = count;
+
+	return 0;
+}
+
+static void context_source_buffers_destroy(struct object_context *context_object)
+{
+	context_output_buffers_destroy(context_object->source_buffers,
+				       context_object->source_buffers_count);
+
+	context_object->source_buffers = NULL;
+	context_object->source_buffers_count = 0;
+}
+
+/*
+ * Only the pictures being built or in flight need their bitstream, so the
+ * source OUTPUT buffers are shared by the surfaces of the context: one for
+ * each request that can be queued and one for the picture being built.
+ */
+static int context_source_buffers_create(struct request_data *driver_data,
+					 struct object_context *context_object,
+					 unsigned int output_type,
+					 int surfaces_count)
+{
+	unsigned int count;
+
+	count = context_object->queue_depth + 1;
+	if (count > (unsigned int)surfaces_count)
+		count = surfaces_count;
+
+	context_object->source_buffers =
+		context_output_buffers_create(driver_data, output_type, count,
+					      context_object->source_size);
+	if (context_object->source_buffers == NULL)
+		return -1;
+
+	context_object->source_buffers_count = count;
+	context_object->source_buffers_index = 0;
+
+	return 0;
+}
+
+VAStatus context_output_buffer_reclaim(struct request_data *driver_data,
+				       struct object_context *context_object,
+				       struct context_output_buffer *buffer)
+{
+	struct object_surface *owner_object;
+	VAStatus status;
+	int timeout;
+
+	if (buffer->request_fd >= 0) {
+		timeout = context_request_timeout(driver_data, context_object);
+
+		status = surface_request_reclaim(driver_data, buffer->request_fd,
+						 buffer->index, timeout);
+		buffer->request_fd = -1;
+
+		if (status != VA_STATUS_SUCCESS)
+			return status;
+	}
+
+	if (buffer->surface_id != VA_INVALID_ID) {
+		owner_object = SURFACE(driver_data, buffer->surface_id);
+		buffer->surface_id = VA_INVALID_ID;
+
+		/* The buffer is still in use by the request of a picture. */
+		if (owner_object != NULL &&
+		    owner_object->output_index == buffer->index &&
+		    owner_object->request_queued) {
+			status = surface_request_wait(driver_data,
+						      owner_object);
+			if (status != VA_STATUS_SUCCESS &&
+			    status != VA_STATUS_ERROR_DECODING_ERROR)
+				return status;
+		}
+	}
+
+	/* The buffer is about to be written again. */
+	context_output_buffer_cpu_access(buffer, true);
+
+	return VA_STATUS_SUCCESS;
+}
+
+int context_output_buffer_queue(struct request_data *driver_data,
+				struct context_output_buffer *buffer,
+				int request_fd, struct timeval *timestamp,
+				unsigned int size, unsigned int flags)
+{
+	struct video_format *video_format = driver_data->video_format;
+	unsigned int output_type;
+
+	output_type = v4l2_type_video_output(video_format->v4l2_mplane);
+
+	if (buffer->fd >= 0) {
+		context_output_buffer_cpu_access(buffer, false);
+
+		return v4l2_queue_dmabuf(driver_data->video_fd, request_fd,
+					 output_type, timestamp, buffer->index,
+					 buffer->fd, size, flags);
+	}
+
+	return v4l2_queue_buffer(driver_data->video_fd, request_fd,
+				 output_type, timestamp, buffer->index, size,
+				 1, flags);
+}
+
+VAStatus context_source_bind(struct request_data *driver_data,
+			     struct object_context *context_object,
+			     struct object_surface *surface_object)
+{
+	struct context_output_buffer *buffer;
+	struct object_surface *owner_object;
+	unsigned int index;
+	VAStatus status;
+
+	index = context_object->source_buffers_index;
+	buffer = &context_object->source_buffers[index];
+
+	owner_object = SURFACE(driver_data, buffer->surface_id);
+
+	status = context_output_buffer_reclaim(driver_data, context_object,
+					       buffer);
+	if (status != VA_STATUS_SUCCESS)
+		return status;
+
+	if (owner_object != NULL && owner_object->source_buffer == (int)index) {
+		owner_object->source_buffer = -1;
+		owner_object->source_data = NULL;
+		owner_object->source_size = 0;
+	}
+
+	context_object->source_buffers_index = (index + 1) %
+		context_object->source_buffers_count;
+
+	buffer->surface_id = surface_object->base.id;
+
+	surface_object->source_buffer = index;
+	surface_object->source_index = buffer->index;
+	surface_object->source_data = buffer->data;
+	surface_object->source_size = buffer->size;
+
+	return VA_STATUS_SUCCESS;
+}
+
+/*
+ * Slice data buffers are carved one after the other from the same OUTPUT
+ * buffer, so that a picture whose buffers were created in submission order
+ * can be queued without copying its data.
+ */
+VAStatus context_slice_carve(struct request_data *driver_data,
+			     struct object_context *context_object,
+			     unsigned int size, int *index,
+			     unsigned int *offset)
+{
+	struct context_output_buffer *buffer;
+	unsigned int next;
+	VAStatus status;
+
+	if (context_object->slice_carved >= 0) {
+		buffer = &context_object->slice_buffers[context_object->slice_carved];
+		if (context_object->slice_carved_offset + size <= buffer->size)
+			goto complete;
+	}
+
+	next = context_object->slice_buffers_index;
+	buffer = &context_object->slice_buffers[next];
+
+	if (size > buffer->size)
+		return VA_STATUS_ERROR_NOT_ENOUGH_BUFFER;
+
+	status = context_output_buffer_reclaim(driver_data, context_object,
+					       buffer);
+	if (status != VA_STATUS_SUCCESS)
+		return status;
+
+	context_object->slice_buffers_index = (next + 1) %
+		context_object->slice_buffers_count;
+	context_object->slice_carved = next;
+	context_object->slice_carved_offset = 0;
+
+complete:
+	*index = context_object->slice_carved;
+	*offset = context_object->slice_carved_offset;
+
+	context_object->slice_carved_offset += size;
+
+	return VA_STATUS_SUCCESS;
+}
+
+/* Carved buffers must not outlive the OUTPUT buffers they point to. */
+static void context_slice_carved_release(struct request_data *driver_data,
+					 VAContextID context_id)
+{
+	struct object_buffer *buffer_object;
+	int iterator;
+
+	buffer_object = (struct object_buffer *)
+		object_heap_first(&driver_data->buffer_heap, &iterator);
+	while (buffer_object != NULL) {
+		if (buffer_object->slice_buffer >= 0 &&
+		    buffer_object->context_id == context_id) {
+			buffer_object->data = NULL;
+			buffer_object->slice_buffer = -1;
+		}
+
+		buffer_object = (struct object_buffer *)
+			object_heap_next(&driver_data->buffer_heap, &iterator);
+	}
+}
+
+static unsigned int context_source_size_align(unsigned int size)
+{
+	return (size + SOURCE_SIZE_ALIGN - 1) / SOURCE_SIZE_ALIGN *
+	       SOURCE_SIZE_ALIGN;
+}
+
+/*
+ * The VA configuration carries no level, so the OUTPUT buffers start sized
+ * for pictures compressed at least four times and grow when one does not fit.
+ */
+static unsigned int context_source_size(int picture_width, int picture_height)
+{
+	unsigned int size;
+
+	size = picture_width * picture_height * 3 / 2 / 4;
+	if (size < SOURCE_SIZE_MIN)
+		size = SOURCE_SIZE_MIN;
+
+	return context_source_size_align(size);
+}
+
+VAStatus context_source_grow(struct request_data *driver_data,
+			     struct object_context *context_object,
+			     struct object_surface *surface_object,
+			     unsigned int size)
+{
+	struct video_format *video_format = driver_data->video_format;
+	struct context_output_buffer *buffer;
+	unsigned int output_type;
+	unsigned int index;
+	unsigned int length;
+	unsigned int offset;
+	void *source_data;
+	int source_fd;
+	int rc;
+
+	if (video_format == NULL || surface_object->source_buffer < 0)
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	output_type = v4l2_type_video_output(video_format->v4l2_mplane);
+
+	if (size < surface_object->source_size * 2)
+		size = surface_object->source_size * 2;
+
+	size = context_source_size_align(size);
+
+	buffer = &context_object->source_buffers[surface_object->source_buffer];
+
+	/* Imported buffers are simply swapped for a larger dmabuf. */
+	if (buffer->fd >= 0) {
+		rc = context_output_dmabuf_alloc(driver_data, size, &source_fd,
+						 &source_data);
+		if (rc < 0)
+			return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+		index = buffer->index;
+		length = size;
+	} else {
+		/*
+		 * OUTPUT buffers cannot be freed while streaming, so the
+		 * source buffer bound to the surface is replaced with a new
+		 * larger one and the previous one is left unused.
+		 */
+		rc = v4l2_create_buffers(driver_data->video_fd, output_type,
+					 driver_data->output_memory, 1, size,
+					 &index);
+		if (rc < 0)
+			return VA_STATUS_ERROR_NOT_ENOUGH_BUFFER;
+
+		rc = v4l2_query_buffer(driver_data->video_fd, output_type,
+				       index, &length, &offset, 1);
+		if (rc < 0)
+			return VA_STATUS_ERROR_NOT_ENOUGH_BUFFER;
+
+		source_data = mmap(NULL, length, PROT_READ | PROT_WRITE,
+				   MAP_SHARED, driver_data->video_fd, offset);
+		if (source_data == MAP_FAILED)
+			return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+		source_fd = -1;
+	}
+
+	memcpy(source_data, buffer->data, surface_object->slices_size);
+	munmap(buffer->data, buffer->size);
+
+	if (buffer->fd >= 0) {
+		context_output_buffer_cpu_access(buffer, false);
+		close(buffer->fd);
+	}
+
+	buffer->index = index;
+	buffer->fd = source_fd;
+	buffer->cpu_access = source_fd >= 0;
+	buffer->data = source_data;
+	buffer->size = length;
+
+	surface_object->source_index = index;
+	surface_object->source_data = source_data;
+	surface_object->source_size = length;
+
+	context_object->stats.grown_count++;
+
+	if (driver_data->stats_enabled)
+		request_log("Context %#x OUTPUT buffer grown to %u bytes\n",
+			    context_object->base.id, length);
+
+	return VA_STATUS_SUCCESS;
+}
+
+/* Optional controls, like scaling matrices, are left out when missing. */
+static bool context_controls_supported(struct request_data *driver_data,
+				       VAProfile profile)
+{
+	static const unsigned int mpeg2_ids[] = {
+		V4L2_CID_MPEG_VIDEO_MPEG2_SLICE_PARAMS,
+	};
+	static const unsigned int h264_ids[] = {
+		V4L2_CID_MPEG_VIDEO_H264_SPS,
+		V4L2_CID_MPEG_VIDEO_H264_PPS,
+		V4L2_CID_MPEG_VIDEO_H264_SLICE_PARAMS,
+		V4L2_CID_MPEG_VIDEO_H264_DECODE_PARAMS,
+	};
+	static const unsigned int h265_ids[] = {
+		V4L2_CID_MPEG_VIDEO_HEVC_SPS,
+		V4L2_CID_MPEG_VIDEO_HEVC_PPS,
+		V4L2_CID_MPEG_VIDEO_HEVC_SLICE_PARAMS,
+	};
+	const unsigned int *ids;
+	unsigned int count;
+	unsigned int i;
+
+	switch (profile) {
+	case VAProfileMPEG2Simple:
+	case VAProfileMPEG2Main:
+		ids = mpeg2_ids;
+		count = sizeof(mpeg2_ids) / sizeof(mpeg2_ids[0]);
+		break;
+
+	case VAProfileH264Main:
+	case VAProfileH264High:
+	case VAProfileH264ConstrainedBaseline:
+	case VAProfileH264MultiviewHigh:
+	case VAProfileH264StereoHigh:
+		ids = h264_ids;
+		count = sizeof(h264_ids) / sizeof(h264_ids[0]);
+		break;
+
+	case VAProfileHEVCMain:
+		ids = h265_ids;
+		count = sizeof(h265_ids) / sizeof(h265_ids[0]);
+		break;
+
+	default:
+		return false;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!control_supported(driver_data, ids[i])) {
+			request_log("Missing control %#x for profile %d\n",
+				    ids[i], profile);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static unsigned int context_slice_params_max(struct request_data *driver_data,
+					     VAProfile profile)
+{
+	struct control_info *control;
+	unsigned int id;
+
+	switch (profile) {
+	case VAProfileMPEG2Simple:
+	case VAProfileMPEG2Main:
+		id = V4L2_CID_MPEG_VIDEO_MPEG2_SLICE_PARAMS;
+		break;
+
+	case VAProfileH264Main:
+	case VAProfileH264High:
+	case VAProfileH264ConstrainedBaseline:
+	case VAProfileH264MultiviewHigh:
+	case VAProfileH264StereoHigh:
+		id = V4L2_CID_MPEG_VIDEO_H264_SLICE_PARAMS;
+		break;
+
+	case VAProfileHEVCMain:
+		id = V4L2_CID_MPEG_VIDEO_HEVC_SLICE_PARAMS;
+		break;
+
+	default:
+		return 1;
+	}
+
+	/* Older drivers expose a single slice parameters element. */
+	control = control_lookup(driver_data, id);
+	if (control == NULL || control->elems == 0)
+		return 1;
+
+	return control->elems;
+}
+
 VAStatus RequestCreateContext(VADriverContextP context, VAConfigID config_id,
 			      int picture_width, int picture_height, int flags,
 			      VASurfaceID *surfaces_ids, int surfaces_count,
@@ -58,16 +811,12 @@ VAStatus RequestCreateContext(VADriverContextP context, VAConfigID config_id,
 	struct object_surface *surface_object;
 	struct object_context *context_object = NULL;
 	struct video_format *video_format;
-	unsigned int length;
-	unsigned int offset;
-	void *source_data = MAP_FAILED;
 	VASurfaceID *ids = NULL;
 	VAContextID id;
 	VAStatus status;
 	unsigned int output_type, capture_type;
 	unsigned int pixelformat;
-	unsigned int index_base;
-	unsigned int index;
+	unsigned int planes_count = 1;
 	unsigned int i;
 	int rc;
 
@@ -92,6 +841,20 @@ VAStatus RequestCreateContext(VADriverContextP context, VAConfigID config_id,
 	}
 	memset(&context_object->dpb, 0, sizeof(context_object->dpb));
 
+	context_object->controls_cache_count = 0;
+	context_object->refs.entries = NULL;
+	context_object->slices_submit = false;
+	context_object->slice_buffers = NULL;
+	context_object->slice_buffers_count = 0;
+	context_object->slice_buffers_index = 0;
+	context_object->slice_pending = -1;
+	context_object->slices_zero_copy = false;
+	context_object->slice_carved = -1;
+	context_object->slice_carved_offset = 0;
+	context_object->source_buffers = NULL;
+	context_object->source_buffers_count = 0;
+	context_object->queue_depth = context_queue_depth(surfaces_count);
+
 	switch (config_object->profile) {
 
 	case VAProfileMPEG2Simple:
@@ -116,20 +879,44 @@ VAStatus RequestCreateContext(VADriverContextP context, VAConfigID config_id,
 		goto error;
 	}
 
+	context_object->source_size = context_source_size(picture_width,
+							   picture_height);
+
 	rc = v4l2_set_format(driver_data->video_fd, output_type, pixelformat,
-			     picture_width, picture_height);
+			     picture_width, picture_height,
+			     context_object->source_size);
 	if (rc < 0) {
 		status = VA_STATUS_ERROR_OPERATION_FAILED;
 		goto error;
 	}
 
-	rc = v4l2_create_buffers(driver_data->video_fd, output_type,
-				 surfaces_count, &index_base);
+	/* The driver may have rounded the OUTPUT buffer size up. */
+	rc = v4l2_get_format(driver_data->video_fd, output_type, NULL, NULL,
+			     NULL, &context_object->source_size,
+			     &planes_count);
 	if (rc < 0) {
-		status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+		status = VA_STATUS_ERROR_OPERATION_FAILED;
+		goto error;
+	}
+
+	driver_data->output_memory = context_output_memory(driver_data,
+							   output_type);
+
+	if (!context_controls_supported(driver_data, config_object->profile)) {
+		status = VA_STATUS_ERROR_UNSUPPORTED_PROFILE;
 		goto error;
 	}
 
+	context_object->slice_params_max =
+		context_slice_params_max(driver_data, config_object->profile);
+
+	context_decode_mode_negotiate(driver_data, context_object,
+				      config_object->profile);
+
+	/* Each request then carries a single slice. */
+	if (context_object->decode_mode == CONTEXT_DECODE_MODE_SLICE_BASED)
+		context_object->slice_params_max = 1;
+
 	/*
 	 * The surface_ids array has been allocated by the caller and
 	 * we don't have any indication wrt its life time. Let's make sure
@@ -144,33 +931,75 @@ VAStatus RequestCreateContext(VADriverContextP context, VAConfigID config_id,
 	memcpy(ids, surfaces_ids, surfaces_count * sizeof(VASurfaceID));
 
 	for (i = 0; i < surfaces_count; i++) {
-		index = index_base + i;
-
 		surface_object = SURFACE(driver_data, surfaces_ids[i]);
 		if (surface_object == NULL) {
 			status = VA_STATUS_ERROR_INVALID_SURFACE;
 			goto error;
 		}
 
-		rc = v4l2_query_buffer(driver_data->video_fd, output_type,
-				       index, &length, &offset, 1);
-		if (rc < 0) {
-			status = VA_STATUS_ERROR_ALLOCATION_FAILED;
-			goto error;
-		}
+		surface_object->source_buffer = -1;
+		surface_object->source_data = NULL;
+		surface_object->source_size = 0;
+	}
 
-		source_data = mmap(NULL, length, PROT_READ | PROT_WRITE,
-				   MAP_SHARED, driver_data->video_fd, offset);
-		if (source_data == MAP_FAILED) {
-			status = VA_STATUS_ERROR_ALLOCATION_FAILED;
-			goto error;
-		}
+	rc = ref_manager_init(&context_object->refs, &driver_data->surface_heap,
+			      ids, surfaces_count);
+	if (rc < 0) {
+		status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+		goto error;
+	}
 
-		surface_object->source_index = index;
-		surface_object->source_data = source_data;
-		surface_object->source_size = length;
+	rc = context_source_buffers_create(driver_data, context_object,
+					   output_type, surfaces_count);
+	if (rc < 0) {
+		status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+		goto error;
+	}
+
+	if (context_slices_submit_supported(driver_data, context_object,
+					    config_object->profile,
+					    output_type)) {
+		rc = context_slice_buffers_create(driver_data, context_object,
+						  output_type);
+		if (rc == 0)
+			context_object->slices_submit = true;
+		else
+			request_log("Unable to create slice buffers, submitting whole pictures\n");
 	}
 
+	/*
+	 * Slice-based decoders only take a single slice per request, without
+	 * per-slice submission the slices of a picture would be lost.
+	 */
+	if (context_object->decode_mode == CONTEXT_DECODE_MODE_SLICE_BASED &&
+	    !context_object->slices_submit) {
+		request_log("Unable to submit slices one by one to a slice-based decoder\n");
+		status = VA_STATUS_ERROR_UNSUPPORTED_PROFILE;
+		goto error;
+	}
+
+	if (!context_object->slices_submit &&
+	    context_slices_zero_copy_supported(context_object)) {
+		rc = context_slice_buffers_create(driver_data, context_object,
+						  output_type);
+		if (rc == 0)
+			context_object->slices_zero_copy = true;
+		else
+			request_log("Unable to create slice buffers, copying slice data\n");
+	}
+
+	/*
+	 * There can't be more requests in flight than OUTPUT buffers, allocate
+	 * them upfront so that decoding does not have to. Missing ones are
+	 * allocated on demand.
+	 */
+	pthread_mutex_lock(&driver_data->mutex);
+	media_request_pool_fill(&driver_data->request_pool,
+				driver_data->media_fd,
+				context_object->source_buffers_count +
+				context_object->slice_buffers_count);
+	pthread_mutex_unlock(&driver_data->mutex);
+
 	rc = v4l2_set_stream(driver_data->video_fd, output_type, true);
 	if (rc < 0) {
 		status = VA_STATUS_ERROR_OPERATION_FAILED;
@@ -190,6 +1019,17 @@ VAStatus RequestCreateContext(VADriverContextP context, VAConfigID config_id,
 	context_object->picture_width = picture_width;
 	context_object->picture_height = picture_height;
 	context_object->flags = flags;
+	context_object->timestamp_sequence = 0;
+	context_object->decode_time_average = 0;
+	context_object->decode_time_count = 0;
+	context_object->queued_count = 0;
+	memset(&context_object->stats, 0, sizeof(context_object->stats));
+
+	if (driver_data->stats_enabled)
+		request_log("Context %#x queue depth is %u, %u OUTPUT buffers of %u bytes\n",
+			    id, context_object->queue_depth,
+			    context_object->source_buffers_count,
+			    context_object->source_size);
 
 	*context_id = id;
 
@@ -197,12 +1037,15 @@ VAStatus RequestCreateContext(VADriverContextP context, VAConfigID config_id,
 	goto complete;
 
 error:
-	if (source_data != MAP_FAILED)
-		munmap(source_data, length);
-
 	if (ids != NULL)
 		free(ids);
 
+	if (context_object != NULL) {
+		context_slice_buffers_destroy(context_object);
+		context_source_buffers_destroy(context_object);
+		ref_manager_cleanup(&context_object->refs);
+	}
+
 	if (context_object != NULL)
 		object_heap_free(&driver_data->context_heap,
 				 (struct object_base *)context_object);
@@ -239,6 +1082,23 @@ VAStatus RequestDestroyContext(VADriverContextP context, VAContextID context_id)
 	if (rc < 0)
 		return VA_STATUS_ERROR_OPERATION_FAILED;
 
+	surface_request_flush(driver_data);
+
+	context_slice_carved_release(driver_data, context_id);
+	context_slice_buffers_destroy(context_object);
+	context_source_buffers_destroy(context_object);
+	context_controls_cache_invalidate(context_object);
+	ref_manager_cleanup(&context_object->refs);
+
+	if (driver_data->stats_enabled)
+		request_log("Context %#x: %u requests, depth %u, %u in flight at most, blocked %u times, %u us average decode time, %u OUTPUT buffers grown\n",
+			    context_id, context_object->stats.queued_count,
+			    context_object->queue_depth,
+			    context_object->stats.queued_max,
+			    context_object->stats.blocked_count,
+			    context_object->decode_time_average,
+			    context_object->stats.grown_count);
+
 	/* Buffers liberation */
 
 	status = RequestDestroySurfaces(context, context_object->surfaces_ids,
@@ -251,13 +1111,157 @@ VAStatus RequestDestroyContext(VADriverContextP context, VAContextID context_id)
 	object_heap_free(&driver_data->context_heap,
 			 (struct object_base *)context_object);
 
-	rc = v4l2_request_buffers(driver_data->video_fd, output_type, 0);
+	rc = v4l2_request_buffers(driver_data->video_fd, output_type,
+				  driver_data->output_memory, 0);
 	if (rc < 0)
 		return VA_STATUS_ERROR_OPERATION_FAILED;
 
-	rc = v4l2_request_buffers(driver_data->video_fd, capture_type, 0);
+	rc = v4l2_request_buffers(driver_data->video_fd, capture_type,
+				  V4L2_MEMORY_MMAP, 0);
 	if (rc < 0)
 		return VA_STATUS_ERROR_OPERATION_FAILED;
 
 	return VA_STATUS_SUCCESS;
 }
+
+/*
+ * Until enough frames were decoded, the timeout is derived from the picture
+ * size, with 1080p allowed 200 ms. It then follows the recent decode times,
+ * so that stuck requests are detected quickly on low-latency streams while
+ * slow hardware still gets the time it needs.
+ */
+#define CONTEXT_DECODE_HISTORY_MIN	4
+
+int context_request_timeout(struct request_data *driver_data,
+			    struct object_context *context_object)
+{
+	unsigned int pixels;
+	uint64_t timeout;
+
+	if (driver_data->request_timeout > 0)
+		return driver_data->request_timeout;
+
+	if (context_object == NULL)
+		return CONTEXT_TIMEOUT_DEFAULT;
+
+	if (context_object->decode_time_count >= CONTEXT_DECODE_HISTORY_MIN) {
+		timeout = (uint64_t)context_object->decode_time_average * 4 /
+			  1000 + CONTEXT_TIMEOUT_MIN;
+	} else {
+		pixels = context_object->picture_width *
+			 context_object->picture_height;
+		timeout = 100 + 100 * (uint64_t)pixels / (1920 * 1088);
+	}
+
+	if (timeout < CONTEXT_TIMEOUT_MIN)
+		timeout = CONTEXT_TIMEOUT_MIN;
+	else if (timeout > CONTEXT_TIMEOUT_MAX)
+		timeout = CONTEXT_TIMEOUT_MAX;
+
+	return (int)timeout;
+}
+
+/*
+ * References are matched by the timestamp of their CAPTURE buffer, which is
+ * numbered after the frames of the context rather than the time of day: it is
+ * unique, never steps back and is cheap to get.
+ */
+void context_timestamp_next(struct object_context *context_object,
+			    struct timeval *timestamp)
+{
+	uint64_t sequence;
+
+	sequence = ++context_object->timestamp_sequence;
+
+	timestamp->tv_sec = sequence / 1000000;
+	timestamp->tv_usec = sequence % 1000000;
+}
+
+void context_decode_time_account(struct object_context *context_object,
+				 unsigned int decode_time)
+{
+	int delta;
+
+	if (context_object->decode_time_count == 0) {
+		context_object->decode_time_average = decode_time;
+	} else {
+		delta = (int)decode_time -
+			(int)context_object->decode_time_average;
+		context_object->decode_time_average += delta / 8;
+	}
+
+	context_object->decode_time_count++;
+}
+
+/*
+ * A request leaves out the controls whose payload did not change since the
+ * previous one, since the kernel then carries over the value of the previous
+ * request. Only the controls the driver accepted are stored and the cache is
+ * invalidated whenever a request is not queued, as the values it holds were
+ * then never applied.
+ */
+static struct context_control_cache *
+context_control_cache_find(struct object_context *context_object,
+			   unsigned int id)
+{
+	unsigned int i;
+
+	for (i = 0; i < context_object->controls_cache_count; i++)
+		if (context_object->controls_cache[i].id == id)
+			return &context_object->controls_cache[i];
+
+	return NULL;
+}
+
+bool context_control_cached(struct object_context *context_object,
+			    unsigned int id, void *data, unsigned int size)
+{
+	struct context_control_cache *cache;
+
+	cache = context_control_cache_find(context_object, id);
+
+	return cache != NULL && cache->size == size &&
+	       memcmp(cache->data, data, size) == 0;
+}
+
+void context_control_cache_store(struct object_context *context_object,
+				 unsigned int id, void *data, unsigned int size)
+{
+	struct context_control_cache *cache;
+
+	cache = context_control_cache_find(context_object, id);
+	if (cache == NULL) {
+		if (context_object->controls_cache_count >=
+		    CONTEXT_CONTROLS_CACHE_MAX)
+			return;
+
+		cache = &context_object->controls_cache[context_object->controls_cache_count++];
+		cache->id = id;
+		cache->data = NULL;
+		cache->size = 0;
+	}
+
+	if (cache->size != size) {
+		free(cache->data);
+
+		cache->data = malloc(size);
+		if (cache->data == NULL) {
+			cache->size = 0;
+			return;
+		}
+
+		cache->size = size;
+	}
+
+	memcpy(cache->data, data, size);
+}
+
+void context_controls_cache_invalidate(struct object_context *context_object)
+{
+	unsigned int i;
+
+	for (i = 0; i < context_object->controls_cache_count; i++)
+		free(context_object->controls_cache[i].data);
+
+	context_object->controls_cache_count = 0;
+}
@@ -27,15 +27,64 @@
 #ifndef _CONTEXT_H_
 #define _CONTEXT_H_
 
+#include <sys/time.h>
+
 #include <va/va_backend.h>
 
 #include "object_heap.h"
 #include "h264.h"
+#include "ref.h"
 
 #define CONTEXT(data, id)                                                      \
 	((struct object_context *)object_heap_lookup(&(data)->context_heap, id))
 #define CONTEXT_ID_OFFSET		0x02000000
 
+#define CONTEXT_TIMEOUT_DEFAULT		300
+#define CONTEXT_TIMEOUT_MIN		20
+#define CONTEXT_TIMEOUT_MAX		5000
+
+struct request_data;
+struct object_surface;
+
+/* Decoding mode negotiated with the driver, when it exposes one. */
+enum context_decode_mode {
+	CONTEXT_DECODE_MODE_ANY,
+	CONTEXT_DECODE_MODE_SLICE_BASED,
+	CONTEXT_DECODE_MODE_FRAME_BASED,
+};
+
+#define CONTEXT_SLICE_BUFFERS_MAX	8
+#define CONTEXT_QUEUE_DEPTH_DEFAULT	4
+
+/*
+ * OUTPUT buffer owned by the context: either the source buffer of a picture,
+ * used to submit a single slice on its own or holding the slice data buffers
+ * of a picture submitted without copy.
+ */
+struct context_output_buffer {
+	unsigned int index;
+	/* Imported dmabuf, negative for MMAP buffers. */
+	int fd;
+	void *data;
+	unsigned int size;
+	/* The dmabuf is open for CPU access, until it is queued. */
+	bool cpu_access;
+
+	/* Request of an intermediate slice, until it is reclaimed. */
+	int request_fd;
+	/* Surface whose picture was last submitted from this buffer. */
+	VASurfaceID surface_id;
+};
+
+#define CONTEXT_CONTROLS_CACHE_MAX	4
+
+/* Payload of a control as last set along with a request. */
+struct context_control_cache {
+	unsigned int id;
+	void *data;
+	unsigned int size;
+};
+
 struct object_context {
 	struct object_base base;
 
@@ -48,6 +97,58 @@ struct object_context {
 	int picture_height;
 	int flags;
 
+	/* Frames submitted so far, numbering the buffer timestamps. */
+	uint64_t timestamp_sequence;
+
+	/* Moving average of the decode time in us. */
+	unsigned int decode_time_average;
+	unsigned int decode_time_count;
+
+	/* Maximum and current number of requests in flight. */
+	unsigned int queue_depth;
+	unsigned int queued_count;
+
+	struct {
+		unsigned int queued_count;
+		unsigned int queued_max;
+		unsigned int blocked_count;
+		unsigned int grown_count;
+	} stats;
+
+	/* Size requested for the OUTPUT buffers. */
+	unsigned int source_size;
+
+	/* OUTPUT buffers bound to the pictures being built or in flight. */
+	struct context_output_buffer *source_buffers;
+	unsigned int source_buffers_count;
+	unsigned int source_buffers_index;
+
+	/* Per-slice submission, holding the capture buffer between slices. */
+	bool slices_submit;
+	struct context_output_buffer *slice_buffers;
+	unsigned int slice_buffers_count;
+	unsigned int slice_buffers_index;
+	int slice_pending;
+
+	/* Slice data buffers carved from the slice buffers, without copy. */
+	bool slices_zero_copy;
+	int slice_carved;
+	unsigned int slice_carved_offset;
+
+	/* Slice parameters the driver accepts along with a single request. */
+	unsigned int slice_params_max;
+
+	enum context_decode_mode decode_mode;
+	/* Slice data is prefixed with Annex-B start codes. */
+	bool start_codes;
+
+	/* Sequence and picture-level controls, only set when they change. */
+	struct context_control_cache controls_cache[CONTEXT_CONTROLS_CACHE_MAX];
+	unsigned int controls_cache_count;
+
+	/* Render targets, as references of the pictures. */
+	struct ref_manager refs;
+
 	/* H264 only */
 	struct h264_dpb dpb;
 };
@@ -58,5 +159,34 @@ VAStatus RequestCreateContext(VADriverContextP context, VAConfigID config_id,
 			      VAContextID *context_id);
 VAStatus RequestDestroyContext(VADriverContextP context,
 			       VAContextID context_id);
+int context_request_timeout(struct request_data *driver_data,
+			    struct object_context *context_object);
+void context_timestamp_next(struct object_context *context_object,
+			    struct timeval *timestamp);
+void context_decode_time_account(struct object_context *context_object,
+				 unsigned int decode_time);
+VAStatus context_source_bind(struct request_data *driver_data,
+			     struct object_context *context_object,
+			     struct object_surface *surface_object);
+VAStatus context_source_grow(struct request_data *driver_data,
+			     struct object_context *context_object,
+			     struct object_surface *surface_object,
+			     unsigned int size);
+VAStatus context_output_buffer_reclaim(struct request_data *driver_data,
+				       struct object_context *context_object,
+				       struct context_output_buffer *buffer);
+int context_output_buffer_queue(struct request_data *driver_data,
+				struct context_output_buffer *buffer,
+				int request_fd, struct timeval *timestamp,
+				unsigned int size, unsigned int flags);
+bool context_control_cached(struct object_context *context_object,
+			    unsigned int id, void *data, unsigned int size);
+void context_control_cache_store(struct object_context *context_object,
+				 unsigned int id, void *data, unsigned int size);
+void context_controls_cache_invalidate(struct object_context *context_object);
+VAStatus context_slice_carve(struct request_data *driver_data,
+			     struct object_context *context_object,
+			     unsigned int size, int *index,
+			     unsigned int *offset);
 
 #endif
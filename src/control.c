@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2018 Paul Kocialkowski <paul.kocialkowski@bootlin.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <linux/videodev2.h>
+#include <mpeg2-ctrls.h>
+#include <h264-ctrls.h>
+#include <hevc-ctrls.h>
+
+#include "control.h"
+#include "request.h"
+#include "utils.h"
+#include "v4l2.h"
+
+/*
+ * Compound controls are laid out after the vendored headers, which follow
+ * staging kernel interfaces. A control whose element size differs from the
+ * expected one is considered unsupported, rather than failing to be set with
+ * every request.
+ */
+static const struct {
+	unsigned int id;
+	unsigned int size;
+} control_descs[] = {
+	{ V4L2_CID_MPEG_VIDEO_MPEG2_SLICE_PARAMS,
+	  sizeof(struct v4l2_ctrl_mpeg2_slice_params) },
+	{ V4L2_CID_MPEG_VIDEO_MPEG2_QUANTIZATION,
+	  sizeof(struct v4l2_ctrl_mpeg2_quantization) },
+	{ V4L2_CID_MPEG_VIDEO_H264_SPS,
+	  sizeof(struct v4l2_ctrl_h264_sps) },
+	{ V4L2_CID_MPEG_VIDEO_H264_PPS,
+	  sizeof(struct v4l2_ctrl_h264_pps) },
+	{ V4L2_CID_MPEG_VIDEO_H264_SCALING_MATRIX,
+	  sizeof(struct v4l2_ctrl_h264_scaling_matrix) },
+	{ V4L2_CID_MPEG_VIDEO_H264_SLICE_PARAMS,
+	  sizeof(struct v4l2_ctrl_h264_slice_params) },
+	{ V4L2_CID_MPEG_VIDEO_H264_DECODE_PARAMS,
+	  sizeof(struct v4l2_ctrl_h264_decode_params) },
+	{ V4L2_CID_MPEG_VIDEO_H264_DECODE_MODE, 0 },
+	{ V4L2_CID_MPEG_VIDEO_H264_START_CODE, 0 },
+	{ V4L2_CID_MPEG_VIDEO_HEVC_SPS,
+	  sizeof(struct v4l2_ctrl_hevc_sps) },
+	{ V4L2_CID_MPEG_VIDEO_HEVC_PPS,
+	  sizeof(struct v4l2_ctrl_hevc_pps) },
+	{ V4L2_CID_MPEG_VIDEO_HEVC_SLICE_PARAMS,
+	  sizeof(struct v4l2_ctrl_hevc_slice_params) },
+	{ V4L2_CID_MPEG_VIDEO_HEVC_DECODE_MODE, 0 },
+	{ V4L2_CID_MPEG_VIDEO_HEVC_START_CODE, 0 },
+};
+
+void control_table_init(struct request_data *driver_data)
+{
+	struct v4l2_query_ext_ctrl query;
+	struct control_info *control;
+	unsigned int count;
+	unsigned int i;
+	int rc;
+
+	count = sizeof(control_descs) / sizeof(control_descs[0]);
+	if (count > CONTROLS_MAX)
+		count = CONTROLS_MAX;
+
+	for (i = 0; i < count; i++) {
+		control = &driver_data->controls[i];
+
+		memset(control, 0, sizeof(*control));
+		control->id = control_descs[i].id;
+
+		rc = v4l2_query_control(driver_data->video_fd, control->id,
+					&query);
+		if (rc < 0)
+			continue;
+
+		if (control_descs[i].size > 0 &&
+		    query.elem_size != control_descs[i].size) {
+			request_log("Control %s has %u bytes elements instead of %u\n",
+				    query.name, query.elem_size,
+				    control_descs[i].size);
+			continue;
+		}
+
+		control->supported = true;
+		control->elem_size = query.elem_size;
+		control->elems = query.elems;
+		control->nr_of_dims = query.nr_of_dims;
+		memcpy(control->dims, query.dims, sizeof(control->dims));
+
+		if (query.type == V4L2_CTRL_TYPE_MENU)
+			v4l2_query_control_menu(driver_data->video_fd,
+						control->id, query.minimum,
+						query.maximum,
+						&control->menu_mask);
+	}
+
+	driver_data->controls_count = count;
+}
+
+struct control_info *control_lookup(struct request_data *driver_data,
+				    unsigned int id)
+{
+	unsigned int i;
+
+	for (i = 0; i < driver_data->controls_count; i++)
+		if (driver_data->controls[i].id == id)
+			return driver_data->controls[i].supported ?
+			       &driver_data->controls[i] : NULL;
+
+	return NULL;
+}
+
+bool control_supported(struct request_data *driver_data, unsigned int id)
+{
+	return control_lookup(driver_data, id) != NULL;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2018 Paul Kocialkowski <paul.kocialkowski@bootlin.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _CONTROL_H_
+#define _CONTROL_H_
+
+#include <stdbool.h>
+
+#include <linux/videodev2.h>
+
+struct request_data;
+
+/* Codec controls known to the backend, queried once at initialization. */
+#define CONTROLS_MAX			16
+
+struct control_info {
+	unsigned int id;
+	bool supported;
+	unsigned int elem_size;
+	unsigned int elems;
+	unsigned int nr_of_dims;
+	unsigned int dims[V4L2_CTRL_MAX_DIMS];
+	/* Supported values of menu controls, as a bitmask. */
+	unsigned int menu_mask;
+};
+
+void control_table_init(struct request_data *driver_data);
+struct control_info *control_lookup(struct request_data *driver_data,
+				    unsigned int id);
+bool control_supported(struct request_data *driver_data, unsigned int id);
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2019 Bootlin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <pthread.h>
+#include <string.h>
+
+#include "detile.h"
+#include "tiled_yuv.h"
+#include "utils.h"
+
+/*
+ * Converting tiled frames to linear images is the most expensive part of
+ * reading back high-resolution surfaces. Each row of 32x32 tiles maps to 32
+ * independent lines of the destination plane, so rows of tiles are spread
+ * over an optional pool of worker threads, the caller taking part as well.
+ */
+
+#define DETILE_TILE_WIDTH	32
+#define DETILE_TILE_HEIGHT	32
+
+static void detile_pool_work(struct detile_pool *pool)
+{
+	unsigned int tiles = (pool->width + DETILE_TILE_WIDTH - 1) /
+			     DETILE_TILE_WIDTH;
+	unsigned int row;
+	unsigned int height;
+	unsigned char *src;
+	unsigned char *dst;
+
+	while (1) {
+		pthread_mutex_lock(&pool->mutex);
+		row = pool->next_row;
+		if (row < pool->rows)
+			pool->next_row++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		if (row >= pool->rows)
+			break;
+
+		src = (unsigned char *)pool->src +
+		      row * tiles * DETILE_TILE_WIDTH * DETILE_TILE_HEIGHT;
+		dst = (unsigned char *)pool->dst +
+		      row * DETILE_TILE_HEIGHT * pool->dst_pitch;
+
+		height = pool->height - row * DETILE_TILE_HEIGHT;
+		if (height > DETILE_TILE_HEIGHT)
+			height = DETILE_TILE_HEIGHT;
+
+		tiled_to_planar(src, dst, pool->dst_pitch, pool->width, height);
+	}
+}
+
+static void *detile_pool_thread(void *data)
+{
+	struct detile_pool *pool = data;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	while (1) {
+		while (!pool->stop && pool->generation == generation)
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+
+		if (pool->stop)
+			break;
+
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+
+		detile_pool_work(pool);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->active == 0)
+			pthread_cond_signal(&pool->done_cond);
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+int detile_pool_start(struct detile_pool *pool, unsigned int threads)
+{
+	unsigned int i;
+	int rc;
+
+	memset(pool, 0, sizeof(*pool));
+
+	if (threads > DETILE_THREADS_MAX)
+		threads = DETILE_THREADS_MAX;
+
+	if (threads < 2)
+		return 0;
+
+	pthread_mutex_init(&pool->submit_mutex, NULL);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	for (i = 0; i < threads - 1; i++) {
+		rc = pthread_create(&pool->threads[i], NULL,
+				    detile_pool_thread, pool);
+		if (rc != 0) {
+			request_log("Unable to create detile thread: %s\n",
+				    strerror(rc));
+			break;
+		}
+	}
+
+	pool->threads_count = i;
+	pool->enabled = true;
+
+	if (pool->threads_count == 0) {
+		detile_pool_stop(pool);
+		return -1;
+	}
+
+	return 0;
+}
+
+void detile_pool_stop(struct detile_pool *pool)
+{
+	unsigned int i;
+
+	if (!pool->enabled)
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->threads_count; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_mutex_destroy(&pool->submit_mutex);
+
+	pool->threads_count = 0;
+	pool->enabled = false;
+}
+
+void detile_tiled_to_planar(struct detile_pool *pool, void *src, void *dst,
+			    unsigned int dst_pitch, unsigned int width,
+			    unsigned int height)
+{
+	unsigned int rows = (height + DETILE_TILE_HEIGHT - 1) /
+			    DETILE_TILE_HEIGHT;
+
+	/* Waking up the workers costs more than it saves on small planes. */
+	if (!pool->enabled || rows < 2 ||
+	    width * height < DETILE_THREADED_SIZE_MIN) {
+		tiled_to_planar(src, dst, dst_pitch, width, height);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->submit_mutex);
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->src = src;
+	pool->dst = dst;
+	pool->dst_pitch = dst_pitch;
+	pool->width = width;
+	pool->height = height;
+	pool->rows = rows;
+	pool->next_row = 0;
+	pool->active = pool->threads_count;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	detile_pool_work(pool);
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->active > 0)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+
+	pthread_mutex_unlock(&pool->submit_mutex);
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2019 Bootlin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _DETILE_H_
+#define _DETILE_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+
+/* Threads converting a tiled plane, including the calling one. */
+#define DETILE_THREADS_MAX		8
+
+/* Planes smaller than this are converted on the calling thread only. */
+#define DETILE_THREADED_SIZE_MIN	(1280 * 720)
+
+struct detile_pool {
+	bool enabled;
+	bool stop;
+
+	pthread_t threads[DETILE_THREADS_MAX - 1];
+	unsigned int threads_count;
+
+	/* Serializes the conversions submitted by different callers. */
+	pthread_mutex_t submit_mutex;
+
+	/* Protects the job and wakes the workers or the caller. */
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+
+	/* Conversion split in rows of tiles, grabbed one at a time. */
+	unsigned int generation;
+	unsigned int active;
+	void *src;
+	void *dst;
+	unsigned int dst_pitch;
+	unsigned int width;
+	unsigned int height;
+	unsigned int rows;
+	unsigned int next_row;
+};
+
+int detile_pool_start(struct detile_pool *pool, unsigned int threads);
+void detile_pool_stop(struct detile_pool *pool);
+void detile_tiled_to_planar(struct detile_pool *pool, void *src, void *dst,
+			    unsigned int dst_pitch, unsigned int width,
+			    unsigned int height);
+
+#endif
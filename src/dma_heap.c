@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2018 Paul Kocialkowski <paul.kocialkowski@bootlin.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/dma-buf.h>
+
+#include "autoconfig.h"
+
+#ifdef HAVE_DMA_HEAP
+#include <linux/dma-heap.h>
+#endif
+
+#include "dma_heap.h"
+#include "utils.h"
+
+#ifdef HAVE_DMA_HEAP
+
+int dma_heap_open(const char *path)
+{
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		request_log("Unable to open DMA heap %s: %s\n", path,
+			    strerror(errno));
+		return -1;
+	}
+
+	return fd;
+}
+
+int dma_heap_alloc(int heap_fd, unsigned int size)
+{
+	struct dma_heap_allocation_data data;
+	int rc;
+
+	memset(&data, 0, sizeof(data));
+	data.len = size;
+	data.fd_flags = O_RDWR | O_CLOEXEC;
+
+	rc = ioctl(heap_fd, DMA_HEAP_IOCTL_ALLOC, &data);
+	if (rc < 0) {
+		request_log("Unable to allocate %u bytes from DMA heap: %s\n",
+			    size, strerror(errno));
+		return -1;
+	}
+
+	return data.fd;
+}
+
+#else
+
+/* Built without the DMA heap headers, MMAP buffers are always used. */
+int dma_heap_open(const char *path)
+{
+	request_log("Unable to open DMA heap %s: not supported by this build\n",
+		    path);
+
+	return -1;
+}
+
+int dma_heap_alloc(int heap_fd, unsigned int size)
+{
+	return -1;
+}
+
+#endif
+
+/*
+ * Brackets CPU access to a mapped dmabuf, so that caches are maintained on
+ * platforms where devices are not coherent with the CPU.
+ */
+int dma_buf_sync(int fd, bool start)
+{
+	struct dma_buf_sync sync;
+	int rc;
+
+	memset(&sync, 0, sizeof(sync));
+	sync.flags = (start ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END) |
+		     DMA_BUF_SYNC_RW;
+
+	do {
+		rc = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+	} while (rc < 0 && (errno == EINTR || errno == EAGAIN));
+
+	if (rc < 0) {
+		request_log("Unable to sync dmabuf: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
@@ -27,6 +27,7 @@
 
 #include <assert.h>
 #include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <sys/ioctl.h>
@@ -37,6 +38,7 @@
 
 #include "request.h"
 #include "surface.h"
+#include "utils.h"
 #include "v4l2.h"
 
 enum h264_slice_type {
@@ -97,10 +99,28 @@ static struct h264_dpb_entry *dpb_find_entry(struct object_context *context)
 static struct h264_dpb_entry *dpb_lookup(struct object_context *context,
 					 VAPictureH264 *pic, unsigned int *idx)
 {
+	struct h264_dpb_entry *entry;
+	struct ref_entry *ref;
 	unsigned int i;
 
+	/* Render targets know their slot, other surfaces are looked for. */
+	ref = ref_lookup(&context->refs, pic->picture_id);
+	if (ref != NULL) {
+		if (ref->slot < 0)
+			return NULL;
+
+		entry = &context->dpb.entries[ref->slot];
+		if (!entry->valid || entry->pic.picture_id != pic->picture_id)
+			return NULL;
+
+		if (idx)
+			*idx = ref->slot;
+
+		return entry;
+	}
+
 	for (i = 0; i < H264_DPB_SIZE; i++) {
-		struct h264_dpb_entry *entry = &context->dpb.entries[i];
+		entry = &context->dpb.entries[i];
 
 		if (!entry->valid)
 			continue;
@@ -116,8 +136,17 @@ static struct h264_dpb_entry *dpb_lookup(struct object_context *context,
 	return NULL;
 }
 
-static void dpb_clear_entry(struct h264_dpb_entry *entry, bool reserved)
+static void dpb_clear_entry(struct object_context *context,
+			    struct h264_dpb_entry *entry, bool reserved)
 {
+	struct ref_entry *ref;
+
+	if (entry->valid) {
+		ref = ref_lookup(&context->refs, entry->pic.picture_id);
+		if (ref != NULL)
+			ref->slot = -1;
+	}
+
 	memset(entry, 0, sizeof(*entry));
 
 	if (reserved)
@@ -127,6 +156,8 @@ static void dpb_clear_entry(struct h264_dpb_entry *entry, bool reserved)
 static void dpb_insert(struct object_context *context, VAPictureH264 *pic,
 		       struct h264_dpb_entry *entry)
 {
+	struct ref_entry *ref;
+
 	if (is_picture_null(pic))
 		return;
 
@@ -136,6 +167,9 @@ static void dpb_insert(struct object_context *context, VAPictureH264 *pic,
 	if (!entry)
 		entry = dpb_find_entry(context);
 
+	/* The oldest unused entry is evicted. */
+	dpb_clear_entry(context, entry, false);
+
 	memcpy(&entry->pic, pic, sizeof(entry->pic));
 	entry->age = context->dpb.age;
 	entry->valid = true;
@@ -143,6 +177,10 @@ static void dpb_insert(struct object_context *context, VAPictureH264 *pic,
 
 	if (!(pic->flags & VA_PICTURE_H264_INVALID))
 		entry->used = true;
+
+	ref = ref_lookup(&context->refs, pic->picture_id);
+	if (ref != NULL)
+		ref->slot = entry - context->dpb.entries;
 }
 
 static void dpb_update(struct object_context *context,
@@ -177,6 +215,7 @@ static void dpb_update(struct object_context *context,
 
 static void h264_fill_dpb(struct request_data *data,
 			  struct object_context *context,
+			  VAPictureH264 *current,
 			  struct v4l2_ctrl_h264_decode_params *decode)
 {
 	int i;
@@ -184,17 +223,21 @@ static void h264_fill_dpb(struct request_data *data,
 	for (i = 0; i < H264_DPB_SIZE; i++) {
 		struct v4l2_h264_dpb_entry *dpb = &decode->dpb[i];
 		struct h264_dpb_entry *entry = &context->dpb.entries[i];
-		struct object_surface *surface =
-			SURFACE(data, entry->pic.picture_id);
 		uint64_t timestamp;
 
 		if (!entry->valid)
 			continue;
 
-		if (surface) {
-			timestamp = v4l2_timeval_to_ns(&surface->timestamp);
+		/*
+		 * The current picture only gets into the DPB once its first
+		 * slice was set up, leave it out for the following ones.
+		 */
+		if (entry->pic.picture_id == current->picture_id)
+			continue;
+
+		if (ref_timestamp(&context->refs, entry->pic.picture_id,
+				  &timestamp))
 			dpb->reference_ts = timestamp;
-		}
 
 		dpb->frame_num = entry->pic.frame_idx;
 		dpb->top_field_order_cnt = entry->pic.TopFieldOrderCnt;
@@ -218,9 +261,8 @@ static void h264_va_picture_to_v4l2(struct request_data *driver_data,
 				    struct v4l2_ctrl_h264_pps *pps,
 				    struct v4l2_ctrl_h264_sps *sps)
 {
-	h264_fill_dpb(driver_data, context, decode);
+	h264_fill_dpb(driver_data, context, &VAPicture->CurrPic, decode);
 
-	decode->num_slices = surface->slices_count;
 	decode->top_field_order_cnt = VAPicture->CurrPic.TopFieldOrderCnt;
 	decode->bottom_field_order_cnt = VAPicture->CurrPic.BottomFieldOrderCnt;
 
@@ -405,65 +447,116 @@ static void h264_va_slice_to_v4l2(struct request_data *driver_data,
 				     VASlice->chroma_offset_l1);
 }
 
-int h264_set_controls(struct request_data *driver_data,
-		      struct object_context *context,
-		      struct object_surface *surface)
+VAStatus h264_set_controls(struct request_data *driver_data,
+			   struct object_context *context,
+			   struct object_surface *surface)
 {
 	struct v4l2_ctrl_h264_scaling_matrix matrix = { 0 };
 	struct v4l2_ctrl_h264_decode_params decode = { 0 };
-	struct v4l2_ctrl_h264_slice_params slice = { 0 };
+	struct v4l2_ctrl_h264_slice_params *slices;
 	struct v4l2_ctrl_h264_pps pps = { 0 };
 	struct v4l2_ctrl_h264_sps sps = { 0 };
-	struct h264_dpb_entry *output;
+	struct v4l2_ext_control controls[5] = { 0 };
+	struct h264_dpb_entry *output = NULL;
+	VASliceParameterBufferH264 *va_slices = surface->slices_params;
+	unsigned int controls_count;
+	unsigned int slices_count;
+	unsigned int i;
 	int rc;
 
-	output = dpb_lookup(context, &surface->params.h264.picture.CurrPic,
-			    NULL);
-	if (!output)
-		output = dpb_find_entry(context);
+	slices_count = surface->slices_count;
+	if (slices_count > context->slice_params_max) {
+		request_log("Unable to fit %u slices in a request, the driver takes %u\n",
+			    slices_count, context->slice_params_max);
+		return VA_STATUS_ERROR_MAX_NUM_EXCEEDED;
+	}
 
-	dpb_clear_entry(output, true);
+	slices = calloc(context->slice_params_max, sizeof(*slices));
+	if (slices == NULL)
+		return VA_STATUS_ERROR_ALLOCATION_FAILED;
 
-	dpb_update(context, &surface->params.h264.picture);
+	/* Slices submitted on their own share the DPB of their picture. */
+	if (surface->slices_submitted == 0) {
+		output = dpb_lookup(context,
+				    &surface->params.h264.picture.CurrPic,
+				    NULL);
+		if (!output)
+			output = dpb_find_entry(context);
+
+		dpb_clear_entry(context, output, true);
+
+		dpb_update(context, &surface->params.h264.picture);
+	}
 
 	h264_va_picture_to_v4l2(driver_data, context, surface,
 				&surface->params.h264.picture,
 				&decode, &pps, &sps);
 	h264_va_matrix_to_v4l2(driver_data, context,
 			       &surface->params.h264.matrix, &matrix);
-	h264_va_slice_to_v4l2(driver_data, context,
-			      &surface->params.h264.slice,
-			      &surface->params.h264.picture, &slice);
+	for (i = 0; i < slices_count; i++)
+		h264_va_slice_to_v4l2(driver_data, context, &va_slices[i],
+				      &surface->params.h264.picture,
+				      &slices[i]);
 
-	rc = v4l2_set_control(driver_data->video_fd, surface->request_fd,
-			      V4L2_CID_MPEG_VIDEO_H264_DECODE_PARAMS, &decode,
-			      sizeof(decode));
-	if (rc < 0)
-		return VA_STATUS_ERROR_OPERATION_FAILED;
+	decode.num_slices = slices_count;
 
-	rc = v4l2_set_control(driver_data->video_fd, surface->request_fd,
-			      V4L2_CID_MPEG_VIDEO_H264_SLICE_PARAMS, &slice,
-			      sizeof(slice));
-	if (rc < 0)
-		return VA_STATUS_ERROR_OPERATION_FAILED;
+	controls[0].id = V4L2_CID_MPEG_VIDEO_H264_DECODE_PARAMS;
+	controls[0].ptr = &decode;
+	controls[0].size = sizeof(decode);
 
-	rc = v4l2_set_control(driver_data->video_fd, surface->request_fd,
-			      V4L2_CID_MPEG_VIDEO_H264_PPS, &pps, sizeof(pps));
-	if (rc < 0)
-		return VA_STATUS_ERROR_OPERATION_FAILED;
+	controls[1].id = V4L2_CID_MPEG_VIDEO_H264_SLICE_PARAMS;
+	controls[1].ptr = slices;
+	controls[1].size = context->slice_params_max * sizeof(*slices);
 
-	rc = v4l2_set_control(driver_data->video_fd, surface->request_fd,
-			      V4L2_CID_MPEG_VIDEO_H264_SPS, &sps, sizeof(sps));
-	if (rc < 0)
-		return VA_STATUS_ERROR_OPERATION_FAILED;
+	controls_count = 2;
+
+	if (!context_control_cached(context, V4L2_CID_MPEG_VIDEO_H264_PPS,
+				    &pps, sizeof(pps))) {
+		controls[controls_count].id = V4L2_CID_MPEG_VIDEO_H264_PPS;
+		controls[controls_count].ptr = &pps;
+		controls[controls_count].size = sizeof(pps);
+		controls_count++;
+	}
 
-	rc = v4l2_set_control(driver_data->video_fd, surface->request_fd,
-			      V4L2_CID_MPEG_VIDEO_H264_SCALING_MATRIX, &matrix,
-			      sizeof(matrix));
+	if (!context_control_cached(context, V4L2_CID_MPEG_VIDEO_H264_SPS,
+				    &sps, sizeof(sps))) {
+		controls[controls_count].id = V4L2_CID_MPEG_VIDEO_H264_SPS;
+		controls[controls_count].ptr = &sps;
+		controls[controls_count].size = sizeof(sps);
+		controls_count++;
+	}
+
+	if (control_supported(driver_data,
+			      V4L2_CID_MPEG_VIDEO_H264_SCALING_MATRIX) &&
+	    !context_control_cached(context,
+				    V4L2_CID_MPEG_VIDEO_H264_SCALING_MATRIX,
+				    &matrix, sizeof(matrix))) {
+		controls[controls_count].id =
+			V4L2_CID_MPEG_VIDEO_H264_SCALING_MATRIX;
+		controls[controls_count].ptr = &matrix;
+		controls[controls_count].size = sizeof(matrix);
+		controls_count++;
+	}
+
+	rc = v4l2_set_controls(driver_data->video_fd, surface->request_fd,
+			       controls, controls_count);
 	if (rc < 0)
-		return VA_STATUS_ERROR_OPERATION_FAILED;
+		goto error;
 
-	dpb_insert(context, &surface->params.h264.picture.CurrPic, output);
+	for (i = 2; i < controls_count; i++)
+		context_control_cache_store(context, controls[i].id,
+					    controls[i].ptr, controls[i].size);
+
+	if (surface->slices_submitted == 0)
+		dpb_insert(context, &surface->params.h264.picture.CurrPic,
+			   output);
+
+	free(slices);
 
 	return VA_STATUS_SUCCESS;
+
+error:
+	free(slices);
+
+	return VA_STATUS_ERROR_OPERATION_FAILED;
 }
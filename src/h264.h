@@ -51,8 +51,8 @@ struct h264_dpb {
 	unsigned int age;
 };
 
-int h264_set_controls(struct request_data *data,
-		      struct object_context *context,
-		      struct object_surface *surface);
+VAStatus h264_set_controls(struct request_data *data,
+			   struct object_context *context,
+			   struct object_surface *surface);
 
 #endif
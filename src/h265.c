@@ -30,6 +30,7 @@
 #include "surface.h"
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <sys/ioctl.h>
@@ -38,6 +39,7 @@
 #include <linux/videodev2.h>
 #include <hevc-ctrls.h>
 
+#include "utils.h"
 #include "v4l2.h"
 
 #define H265_NAL_UNIT_TYPE_SHIFT		1
@@ -159,11 +161,10 @@ static void h265_fill_sps(VAPictureParameterBufferHEVC *picture,
 
 static void h265_fill_slice_params(VAPictureParameterBufferHEVC *picture,
 				   VASliceParameterBufferHEVC *slice,
-				   struct object_heap *surface_heap,
+				   struct ref_manager *refs,
 				   void *source_data,
 				   struct v4l2_ctrl_hevc_slice_params *slice_params)
 {
-	struct object_surface *surface_object;
 	VAPictureHEVC *hevc_picture;
 	uint8_t nal_unit_type;
 	uint8_t nuh_temporal_id_plus1;
@@ -280,13 +281,9 @@ static void h265_fill_slice_params(VAPictureParameterBufferHEVC *picture,
 		    (hevc_picture->flags & VA_PICTURE_HEVC_INVALID) != 0)
 			break;
 
-		surface_object = (struct object_surface *)
-			object_heap_lookup(surface_heap,
-					   hevc_picture->picture_id);
-		if (surface_object == NULL)
+		if (!ref_timestamp(refs, hevc_picture->picture_id, &timestamp))
 			break;
 
-		timestamp = v4l2_timeval_to_ns(&surface_object->timestamp);
 		slice_params->dpb[i].timestamp = timestamp;
 
 		if ((hevc_picture->flags & VA_PICTURE_HEVC_RPS_ST_CURR_BEFORE) != 0) {
@@ -364,44 +361,87 @@ static void h265_fill_slice_params(VAPictureParameterBufferHEVC *picture,
 	}
 }
 
-int h265_set_controls(struct request_data *driver_data,
-		      struct object_context *context_object,
-		      struct object_surface *surface_object)
+VAStatus h265_set_controls(struct request_data *driver_data,
+			   struct object_context *context_object,
+			   struct object_surface *surface_object)
 {
 	VAPictureParameterBufferHEVC *picture =
 		&surface_object->params.h265.picture;
-	VASliceParameterBufferHEVC *slice =
-		&surface_object->params.h265.slice;
+	VASliceParameterBufferHEVC *slices = surface_object->slices_params;
 	VAIQMatrixBufferHEVC *iqmatrix =
 		&surface_object->params.h265.iqmatrix;
 	bool iqmatrix_set = surface_object->params.h265.iqmatrix_set;
 	struct v4l2_ctrl_hevc_pps pps;
 	struct v4l2_ctrl_hevc_sps sps;
-	struct v4l2_ctrl_hevc_slice_params slice_params;
+	struct v4l2_ctrl_hevc_slice_params *slice_params;
+	struct v4l2_ext_control controls[3] = { 0 };
+	unsigned int controls_count;
+	unsigned int slices_count;
+	void *slices_data = surface_object->source_data;
+	unsigned int i;
 	int rc;
 
-	h265_fill_pps(picture, slice, &pps);
+	if (surface_object->slices_count == 0)
+		return VA_STATUS_ERROR_INVALID_PARAMETER;
 
-	rc = v4l2_set_control(driver_data->video_fd, surface_object->request_fd,
-			      V4L2_CID_MPEG_VIDEO_HEVC_PPS, &pps, sizeof(pps));
-	if (rc < 0)
-		return VA_STATUS_ERROR_OPERATION_FAILED;
+	slices_count = surface_object->slices_count;
+	if (slices_count > context_object->slice_params_max) {
+		request_log("Unable to fit %u slices in a request, the driver takes %u\n",
+			    slices_count, context_object->slice_params_max);
+		return VA_STATUS_ERROR_MAX_NUM_EXCEEDED;
+	}
 
+	h265_fill_pps(picture, &slices[0], &pps);
 	h265_fill_sps(picture, &sps);
 
-	rc = v4l2_set_control(driver_data->video_fd, surface_object->request_fd,
-			      V4L2_CID_MPEG_VIDEO_HEVC_SPS, &sps, sizeof(sps));
-	if (rc < 0)
-		return VA_STATUS_ERROR_OPERATION_FAILED;
+	if (surface_object->slices_buffer >= 0)
+		slices_data = context_object->slice_buffers[surface_object->slices_buffer].data;
+
+	slice_params = calloc(context_object->slice_params_max,
+			      sizeof(*slice_params));
+	if (slice_params == NULL)
+		return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+	for (i = 0; i < slices_count; i++)
+		h265_fill_slice_params(picture, &slices[i],
+				       &context_object->refs,
+				       slices_data, &slice_params[i]);
+
+	controls[0].id = V4L2_CID_MPEG_VIDEO_HEVC_SLICE_PARAMS;
+	controls[0].ptr = slice_params;
+	controls[0].size = context_object->slice_params_max *
+			   sizeof(*slice_params);
+
+	controls_count = 1;
+
+	if (!context_control_cached(context_object,
+				    V4L2_CID_MPEG_VIDEO_HEVC_PPS, &pps,
+				    sizeof(pps))) {
+		controls[controls_count].id = V4L2_CID_MPEG_VIDEO_HEVC_PPS;
+		controls[controls_count].ptr = &pps;
+		controls[controls_count].size = sizeof(pps);
+		controls_count++;
+	}
 
-	h265_fill_slice_params(picture, slice, &driver_data->surface_heap,
-			       surface_object->source_data, &slice_params);
+	if (!context_control_cached(context_object,
+				    V4L2_CID_MPEG_VIDEO_HEVC_SPS, &sps,
+				    sizeof(sps))) {
+		controls[controls_count].id = V4L2_CID_MPEG_VIDEO_HEVC_SPS;
+		controls[controls_count].ptr = &sps;
+		controls[controls_count].size = sizeof(sps);
+		controls_count++;
+	}
 
-	rc = v4l2_set_control(driver_data->video_fd, surface_object->request_fd,
-			      V4L2_CID_MPEG_VIDEO_HEVC_SLICE_PARAMS,
-			      &slice_params, sizeof(slice_params));
+	rc = v4l2_set_controls(driver_data->video_fd,
+			       surface_object->request_fd, controls,
+			       controls_count);
+	free(slice_params);
 	if (rc < 0)
 		return VA_STATUS_ERROR_OPERATION_FAILED;
 
-	return 0;
+	for (i = 1; i < controls_count; i++)
+		context_control_cache_store(context_object, controls[i].id,
+					    controls[i].ptr, controls[i].size);
+
+	return VA_STATUS_SUCCESS;
 }
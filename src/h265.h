@@ -27,12 +27,14 @@
 #ifndef _H265_H_
 #define _H265_H_
 
+#include <va/va.h>
+
 struct object_context;
 struct object_surface;
 struct request_data;
 
-int h265_set_controls(struct request_data *driver_data,
-		      struct object_context *context_object,
-		      struct object_surface *surface_object);
+VAStatus h265_set_controls(struct request_data *driver_data,
+			   struct object_context *context_object,
+			   struct object_surface *surface_object);
 
 #endif
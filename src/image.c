@@ -33,6 +33,7 @@
 #include <assert.h>
 #include <string.h>
 
+#include "detile.h"
 #include "tiled_yuv.h"
 #include "utils.h"
 #include "v4l2.h"
@@ -143,9 +144,34 @@ VAStatus RequestDestroyImage(VADriverContextP context, VAImageID image_id)
 	return VA_STATUS_SUCCESS;
 }
 
+static void copy_surface_plane_rect(struct request_data *driver_data,
+				    struct object_surface *surface_object,
+				    unsigned int plane, void *dst,
+				    unsigned int dst_pitch, unsigned int x,
+				    unsigned int y, unsigned int width,
+				    unsigned int height)
+{
+	unsigned int bytesperline =
+		surface_object->destination_bytesperlines[plane];
+	unsigned char *src = surface_object->destination_data[plane];
+	unsigned int i;
+
+	if (!video_format_is_linear(driver_data->video_format)) {
+		tiled_to_planar_rect(src, surface_object->width, dst, dst_pitch,
+				     x, y, width, height);
+		return;
+	}
+
+	for (i = 0; i < height; i++)
+		memcpy((unsigned char *)dst + i * dst_pitch,
+		       src + (y + i) * bytesperline + x, width);
+}
+
 static VAStatus copy_surface_to_image (struct request_data *driver_data,
 				       struct object_surface *surface_object,
-				       VAImage *image)
+				       VAImage *image, unsigned int x,
+				       unsigned int y, unsigned int width,
+				       unsigned int height)
 {
 	struct object_buffer *buffer_object;
 	unsigned int i;
@@ -154,13 +180,36 @@ static VAStatus copy_surface_to_image (struct request_data *driver_data,
 	if (buffer_object == NULL)
 		return VA_STATUS_ERROR_INVALID_BUFFER;
 
+	/*
+	 * Only the lines and tiles covering a smaller rectangle are copied.
+	 * The chroma plane holds interleaved samples at half the vertical
+	 * resolution, a rectangle splitting chroma samples is rejected.
+	 */
+	if (x != 0 || y != 0 || width != (unsigned int)surface_object->width ||
+	    height != (unsigned int)surface_object->height) {
+		if ((x | y | width | height) & 1)
+			return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+		for (i = 0; i < surface_object->destination_planes_count; i++)
+			copy_surface_plane_rect(driver_data, surface_object, i,
+						buffer_object->data +
+						image->offsets[i],
+						image->pitches[i], x,
+						i == 0 ? y : y / 2, width,
+						i == 0 ? height : height / 2);
+
+		return VA_STATUS_SUCCESS;
+	}
+
 	for (i = 0; i < surface_object->destination_planes_count; i++) {
 		if (!video_format_is_linear(driver_data->video_format))
-			tiled_to_planar(surface_object->destination_data[i],
-					buffer_object->data + image->offsets[i],
-					image->pitches[i], image->width,
-					i == 0 ? image->height :
-						 image->height / 2);
+			detile_tiled_to_planar(&driver_data->detile_pool,
+					       surface_object->destination_data[i],
+					       buffer_object->data +
+					       image->offsets[i],
+					       image->pitches[i], image->width,
+					       i == 0 ? image->height :
+							image->height / 2);
 		else {
 			memcpy(buffer_object->data + image->offsets[i],
 			       surface_object->destination_data[i],
@@ -197,7 +246,9 @@ VAStatus RequestDeriveImage(VADriverContextP context, VASurfaceID surface_id,
 	if (status != VA_STATUS_SUCCESS)
 		return status;
 
-	status = copy_surface_to_image (driver_data, surface_object, image);
+	status = copy_surface_to_image (driver_data, surface_object, image, 0,
+					0, surface_object->width,
+					surface_object->height);
 	if (status != VA_STATUS_SUCCESS)
 		return status;
 
@@ -232,20 +283,31 @@ VAStatus RequestGetImage(VADriverContextP context, VASurfaceID surface_id,
 	struct object_surface *surface_object;
 	struct object_image *image_object;
 	VAImage *image;
+	VAStatus status;
 
 	surface_object = SURFACE(driver_data, surface_id);
 	if (surface_object == NULL)
 		return VA_STATUS_ERROR_INVALID_SURFACE;
 
+	if (surface_object->status == VASurfaceRendering) {
+		status = RequestSyncSurface(context, surface_id);
+		if (status != VA_STATUS_SUCCESS)
+			return status;
+	}
+
 	image_object = IMAGE(driver_data, image_id);
 	if (image_object == NULL)
 		return VA_STATUS_ERROR_INVALID_IMAGE;
 
 	image = &image_object->image;
-	if (x != 0 || y != 0 || width != image->width || height != image->height)
-		return VA_STATUS_ERROR_UNIMPLEMENTED;
-
-	return copy_surface_to_image (driver_data, surface_object, image);
+	if (x < 0 || y < 0 || width == 0 || height == 0 ||
+	    x + width > (unsigned int)surface_object->width ||
+	    y + height > (unsigned int)surface_object->height ||
+	    width > image->width || height > image->height)
+		return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+	return copy_surface_to_image (driver_data, surface_object, image, x, y,
+				      width, height);
 }
 
 VAStatus RequestPutImage(VADriverContextP context, VASurfaceID surface_id,
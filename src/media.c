@@ -24,9 +24,11 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <poll.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
-#include <sys/select.h>
+#include <unistd.h>
 
 #include <linux/media.h>
 
@@ -76,24 +78,133 @@ int media_request_queue(int request_fd)
 	return 0;
 }
 
-int media_request_wait_completion(int request_fd)
+int media_request_wait_completion(int request_fd, int timeout)
 {
-	struct timeval tv = { 0, 300000 };
-	fd_set except_fds;
+	struct pollfd pollfd;
 	int rc;
 
-	FD_ZERO(&except_fds);
-	FD_SET(request_fd, &except_fds);
+	memset(&pollfd, 0, sizeof(pollfd));
+	pollfd.fd = request_fd;
+	pollfd.events = POLLPRI;
+
+	do {
+		rc = poll(&pollfd, 1, timeout);
+	} while (rc < 0 && errno == EINTR);
 
-	rc = select(request_fd + 1, NULL, NULL, &except_fds, &tv);
 	if (rc == 0) {
 		request_log("Timeout when waiting for media request\n");
 		return -1;
 	} else if (rc < 0) {
-		request_log("Unable to select media request: %s\n",
+		request_log("Unable to poll media request: %s\n",
 			    strerror(errno));
 		return -1;
 	}
 
 	return 0;
 }
+
+int media_request_pool_fill(struct media_request_pool *pool, int media_fd,
+			    unsigned int count)
+{
+	int fd;
+
+	if (count > MEDIA_REQUEST_POOL_SIZE)
+		count = MEDIA_REQUEST_POOL_SIZE;
+
+	while (pool->count < count) {
+		fd = media_request_alloc(media_fd);
+		if (fd < 0)
+			return -1;
+
+		pool->fds[pool->count++] = fd;
+	}
+
+	return 0;
+}
+
+int media_request_pool_get(struct media_request_pool *pool, int media_fd)
+{
+	if (pool->count > 0)
+		return pool->fds[--pool->count];
+
+	return media_request_alloc(media_fd);
+}
+
+void media_request_pool_put(struct media_request_pool *pool, int request_fd)
+{
+	/* Requests given back must have been reinitialized already. */
+	if (pool->count < MEDIA_REQUEST_POOL_SIZE)
+		pool->fds[pool->count++] = request_fd;
+	else
+		close(request_fd);
+}
+
+void media_request_pool_empty(struct media_request_pool *pool)
+{
+	while (pool->count > 0)
+		close(pool->fds[--pool->count]);
+}
+
+int media_waiter_create(void)
+{
+	int fd;
+
+	fd = epoll_create1(EPOLL_CLOEXEC);
+	if (fd < 0) {
+		request_log("Unable to create media waiter: %s\n",
+			    strerror(errno));
+		return -1;
+	}
+
+	return fd;
+}
+
+int media_waiter_add(int waiter_fd, int fd, uint64_t cookie)
+{
+	struct epoll_event event;
+	int rc;
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLPRI | EPOLLIN;
+	event.data.u64 = cookie;
+
+	rc = epoll_ctl(waiter_fd, EPOLL_CTL_ADD, fd, &event);
+	if (rc < 0) {
+		request_log("Unable to add media waiter fd: %s\n",
+			    strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+void media_waiter_remove(int waiter_fd, int fd)
+{
+	epoll_ctl(waiter_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+int media_waiter_wait(int waiter_fd, uint64_t *cookies, unsigned int count,
+		      int timeout)
+{
+	struct epoll_event events[MEDIA_WAITER_EVENTS_MAX];
+	unsigned int i;
+	int rc;
+
+	if (count > MEDIA_WAITER_EVENTS_MAX)
+		count = MEDIA_WAITER_EVENTS_MAX;
+
+	do {
+		rc = epoll_wait(waiter_fd, events, count, timeout);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc < 0) {
+		request_log("Unable to wait for media requests: %s\n",
+			    strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < (unsigned int)rc; i++)
+		cookies[i] = events[i].data.u64;
+
+	return rc;
+}
@@ -25,9 +25,31 @@
 #ifndef _MEDIA_H_
 #define _MEDIA_H_
 
+#include <stdint.h>
+
+#define MEDIA_WAITER_EVENTS_MAX		16
+
+/* Requests can't outnumber the buffers, bounded by VIDEO_MAX_FRAME. */
+#define MEDIA_REQUEST_POOL_SIZE		32
+
+struct media_request_pool {
+	int fds[MEDIA_REQUEST_POOL_SIZE];
+	unsigned int count;
+};
+
 int media_request_alloc(int media_fd);
 int media_request_reinit(int request_fd);
 int media_request_queue(int request_fd);
-int media_request_wait_completion(int request_fd);
+int media_request_wait_completion(int request_fd, int timeout);
+int media_request_pool_fill(struct media_request_pool *pool, int media_fd,
+			    unsigned int count);
+int media_request_pool_get(struct media_request_pool *pool, int media_fd);
+void media_request_pool_put(struct media_request_pool *pool, int request_fd);
+void media_request_pool_empty(struct media_request_pool *pool);
+int media_waiter_create(void);
+int media_waiter_add(int waiter_fd, int fd, uint64_t cookie);
+void media_waiter_remove(int waiter_fd, int fd);
+int media_waiter_wait(int waiter_fd, uint64_t *cookies, unsigned int count,
+		      int timeout);
 
 #endif
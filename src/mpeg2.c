@@ -29,6 +29,7 @@
 #include "surface.h"
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <sys/ioctl.h>
@@ -39,25 +40,29 @@
 
 #include "v4l2.h"
 
-int mpeg2_set_controls(struct request_data *driver_data,
-		       struct object_context *context_object,
-		       struct object_surface *surface_object)
+VAStatus mpeg2_set_controls(struct request_data *driver_data,
+			    struct object_context *context_object,
+			    struct object_surface *surface_object)
 {
 	VAPictureParameterBufferMPEG2 *picture =
 		&surface_object->params.mpeg2.picture;
-	VASliceParameterBufferMPEG2 *slice =
-		&surface_object->params.mpeg2.slice;
+	VASliceParameterBufferMPEG2 *slices = surface_object->slices_params;
 	VAIQMatrixBufferMPEG2 *iqmatrix =
 		&surface_object->params.mpeg2.iqmatrix;
 	bool iqmatrix_set = surface_object->params.mpeg2.iqmatrix_set;
+	struct v4l2_ctrl_mpeg2_slice_params *slices_params;
 	struct v4l2_ctrl_mpeg2_slice_params slice_params;
 	struct v4l2_ctrl_mpeg2_quantization quantization;
-	struct object_surface *forward_reference_surface;
-	struct object_surface *backward_reference_surface;
+	struct v4l2_ext_control controls[2] = { 0 };
+	unsigned int controls_count;
+	unsigned int slices_count;
 	uint64_t timestamp;
 	unsigned int i;
 	int rc;
 
+	if (surface_object->slices_count == 0)
+		return VA_STATUS_ERROR_INVALID_PARAMETER;
+
 	memset(&slice_params, 0, sizeof(slice_params));
 
 	slice_params.bit_size = surface_object->slices_size * 8;
@@ -65,7 +70,7 @@ int mpeg2_set_controls(struct request_data *driver_data,
 
 	slice_params.sequence.horizontal_size = picture->horizontal_size;
 	slice_params.sequence.vertical_size = picture->vertical_size;
-	slice_params.sequence.vbv_buffer_size = SOURCE_SIZE_MAX;
+	slice_params.sequence.vbv_buffer_size = surface_object->source_size;
 
 	slice_params.sequence.profile_and_level_indication = 0;
 	slice_params.sequence.progressive_sequence = 0;
@@ -99,31 +104,54 @@ int mpeg2_set_controls(struct request_data *driver_data,
 	slice_params.picture.progressive_frame =
 		picture->picture_coding_extension.bits.progressive_frame;
 
-	slice_params.quantiser_scale_code = slice->quantiser_scale_code;
+	slice_params.quantiser_scale_code = slices[0].quantiser_scale_code;
 
-	forward_reference_surface =
-		SURFACE(driver_data, picture->forward_reference_picture);
-	if (forward_reference_surface == NULL)
-		forward_reference_surface = surface_object;
+	/* Missing references point to the current picture. */
+	if (!ref_timestamp(&context_object->refs,
+			   picture->forward_reference_picture, &timestamp))
+		timestamp = v4l2_timeval_to_ns(&surface_object->timestamp);
 
-	timestamp = v4l2_timeval_to_ns(&forward_reference_surface->timestamp);
 	slice_params.forward_ref_ts = timestamp;
 
-	backward_reference_surface =
-		SURFACE(driver_data, picture->backward_reference_picture);
-	if (backward_reference_surface == NULL)
-		backward_reference_surface = surface_object;
+	if (!ref_timestamp(&context_object->refs,
+			   picture->backward_reference_picture, &timestamp))
+		timestamp = v4l2_timeval_to_ns(&surface_object->timestamp);
 
-	timestamp = v4l2_timeval_to_ns(&backward_reference_surface->timestamp);
 	slice_params.backward_ref_ts = timestamp;
 
-	rc = v4l2_set_control(driver_data->video_fd, surface_object->request_fd,
-			      V4L2_CID_MPEG_VIDEO_MPEG2_SLICE_PARAMS,
-			      &slice_params, sizeof(slice_params));
-	if (rc < 0)
-		return VA_STATUS_ERROR_OPERATION_FAILED;
+	/*
+	 * Without room for all the slices, the whole picture is described
+	 * as a single slice and the decoder finds the slice start codes.
+	 */
+	slices_count = surface_object->slices_count;
+	if (slices_count > context_object->slice_params_max)
+		slices_count = 1;
+
+	slices_params = calloc(context_object->slice_params_max,
+			       sizeof(*slices_params));
+	if (slices_params == NULL)
+		return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+	slices_params[0] = slice_params;
+
+	for (i = 0; i < slices_count && slices_count > 1; i++) {
+		slices_params[i] = slice_params;
+		slices_params[i].bit_size = slices[i].slice_data_size * 8;
+		slices_params[i].data_bit_offset =
+			slices[i].slice_data_offset * 8;
+		slices_params[i].quantiser_scale_code =
+			slices[i].quantiser_scale_code;
+	}
+
+	controls[0].id = V4L2_CID_MPEG_VIDEO_MPEG2_SLICE_PARAMS;
+	controls[0].ptr = slices_params;
+	controls[0].size = context_object->slice_params_max *
+			   sizeof(*slices_params);
+	controls_count = 1;
 
-	if (iqmatrix_set) {
+	if (iqmatrix_set &&
+	    control_supported(driver_data,
+			      V4L2_CID_MPEG_VIDEO_MPEG2_QUANTIZATION)) {
 		quantization.load_intra_quantiser_matrix =
 			iqmatrix->load_intra_quantiser_matrix;
 		quantization.load_non_intra_quantiser_matrix =
@@ -144,11 +172,27 @@ int mpeg2_set_controls(struct request_data *driver_data,
 				iqmatrix->chroma_non_intra_quantiser_matrix[i];
 		}
 
-		rc = v4l2_set_control(driver_data->video_fd,
-				      surface_object->request_fd,
-				      V4L2_CID_MPEG_VIDEO_MPEG2_QUANTIZATION,
-				      &quantization, sizeof(quantization));
+		if (!context_control_cached(context_object,
+					    V4L2_CID_MPEG_VIDEO_MPEG2_QUANTIZATION,
+					    &quantization,
+					    sizeof(quantization))) {
+			controls[1].id = V4L2_CID_MPEG_VIDEO_MPEG2_QUANTIZATION;
+			controls[1].ptr = &quantization;
+			controls[1].size = sizeof(quantization);
+			controls_count++;
+		}
 	}
 
-	return 0;
+	rc = v4l2_set_controls(driver_data->video_fd,
+			       surface_object->request_fd, controls,
+			       controls_count);
+	free(slices_params);
+	if (rc < 0)
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	for (i = 1; i < controls_count; i++)
+		context_control_cache_store(context_object, controls[i].id,
+					    controls[i].ptr, controls[i].size);
+
+	return VA_STATUS_SUCCESS;
 }
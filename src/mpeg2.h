@@ -26,12 +26,14 @@
 #ifndef _MPEG2_H_
 #define _MPEG2_H_
 
+#include <va/va.h>
+
 struct object_context;
 struct object_surface;
 struct request_data;
 
-int mpeg2_set_controls(struct request_data *driver_data,
-		       struct object_context *context,
-		       struct object_surface *surface_object);
+VAStatus mpeg2_set_controls(struct request_data *driver_data,
+			    struct object_context *context,
+			    struct object_surface *surface_object);
 
 #endif
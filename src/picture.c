@@ -39,6 +39,7 @@
 #include <string.h>
 
 #include <errno.h>
+#include <unistd.h>
 
 #include <sys/ioctl.h>
 
@@ -50,26 +51,101 @@
 
 #include "autoconfig.h"
 
+/* Location of the data of a slice, in the OUTPUT buffer once stored. */
+static bool slice_data_location(VAProfile profile, void *slices_params,
+				unsigned int index, uint32_t **offset,
+				uint32_t *size)
+{
+	VASliceParameterBufferMPEG2 *slice_mpeg2;
+	VASliceParameterBufferH264 *slice_h264;
+	VASliceParameterBufferHEVC *slice_hevc;
+
+	switch (profile) {
+	case VAProfileMPEG2Simple:
+	case VAProfileMPEG2Main:
+		slice_mpeg2 = (VASliceParameterBufferMPEG2 *)slices_params +
+			      index;
+		*offset = &slice_mpeg2->slice_data_offset;
+		*size = slice_mpeg2->slice_data_size;
+		return true;
+
+	case VAProfileH264Main:
+	case VAProfileH264High:
+	case VAProfileH264ConstrainedBaseline:
+	case VAProfileH264MultiviewHigh:
+	case VAProfileH264StereoHigh:
+		slice_h264 = (VASliceParameterBufferH264 *)slices_params +
+			     index;
+		*offset = &slice_h264->slice_data_offset;
+		*size = slice_h264->slice_data_size;
+		return true;
+
+	case VAProfileHEVCMain:
+		slice_hevc = (VASliceParameterBufferHEVC *)slices_params +
+			     index;
+		*offset = &slice_hevc->slice_data_offset;
+		*size = slice_hevc->slice_data_size;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/* A single slice parameters buffer may carry several slices. */
+static VAStatus codec_store_slices(struct object_surface *surface_object,
+				   struct object_buffer *buffer_object,
+				   unsigned int size)
+{
+	unsigned int i;
+	void *slice;
+
+	for (i = 0; i < buffer_object->count; i++) {
+		slice = surface_slice_params(surface_object,
+					     surface_object->slices_count,
+					     size);
+		if (slice == NULL)
+			return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+		memcpy(slice, buffer_object->data + i * buffer_object->size,
+		       size);
+		surface_object->slices_count++;
+	}
+
+	return VA_STATUS_SUCCESS;
+}
+
 static VAStatus codec_store_buffer(struct request_data *driver_data,
 				   VAProfile profile,
 				   struct object_surface *surface_object,
 				   struct object_buffer *buffer_object)
 {
+	unsigned int index;
+	unsigned int i;
+	uint32_t *offset;
+	uint32_t size;
+	VAStatus status;
+
 	switch (buffer_object->type) {
 	case VASliceDataBufferType:
 		/*
 		 * Since there is no guarantee that the allocation
 		 * order is the same as the submission order (via
 		 * RenderPicture), we can't use a V4L2 buffer directly
-		 * and have to copy from a regular buffer.
+		 * and have to copy from a regular buffer, unless the
+		 * slice data was carved in order.
 		 */
+		if (surface_object->slices_size +
+		    buffer_object->size * buffer_object->count >
+		    surface_object->source_size)
+			return VA_STATUS_ERROR_NOT_ENOUGH_BUFFER;
+
 		memcpy(surface_object->source_data +
 			       surface_object->slices_size,
 		       buffer_object->data,
 		       buffer_object->size * buffer_object->count);
 		surface_object->slices_size +=
 			buffer_object->size * buffer_object->count;
-		surface_object->slices_count++;
 		break;
 
 	case VAPictureParameterBufferType:
@@ -103,26 +179,50 @@ static VAStatus codec_store_buffer(struct request_data *driver_data,
 		break;
 
 	case VASliceParameterBufferType:
+		index = surface_object->slices_count;
+
 		switch (profile) {
+		case VAProfileMPEG2Simple:
+		case VAProfileMPEG2Main:
+			status = codec_store_slices(surface_object,
+						    buffer_object,
+						    sizeof(VASliceParameterBufferMPEG2));
+			break;
+
 		case VAProfileH264Main:
 		case VAProfileH264High:
 		case VAProfileH264ConstrainedBaseline:
 		case VAProfileH264MultiviewHigh:
 		case VAProfileH264StereoHigh:
-			memcpy(&surface_object->params.h264.slice,
-			       buffer_object->data,
-			       sizeof(surface_object->params.h264.slice));
+			status = codec_store_slices(surface_object,
+						    buffer_object,
+						    sizeof(VASliceParameterBufferH264));
 			break;
 
 		case VAProfileHEVCMain:
-			memcpy(&surface_object->params.h265.slice,
-			       buffer_object->data,
-			       sizeof(surface_object->params.h265.slice));
+			status = codec_store_slices(surface_object,
+						    buffer_object,
+						    sizeof(VASliceParameterBufferHEVC));
 			break;
 
 		default:
+			status = VA_STATUS_SUCCESS;
 			break;
 		}
+
+		if (status != VA_STATUS_SUCCESS)
+			return status;
+
+		/*
+		 * Slice data offsets are relative to the slice data buffer
+		 * that follows, which gets appended to the data of the
+		 * previous slices.
+		 */
+		for (i = index; i < surface_object->slices_count; i++)
+			if (slice_data_location(profile,
+						surface_object->slices_params,
+						i, &offset, &size))
+				*offset += surface_object->slices_size;
 		break;
 
 	case VAIQMatrixBufferType:
@@ -169,14 +269,15 @@ static VAStatus codec_set_controls(struct request_data *driver_data,
 				   VAProfile profile,
 				   struct object_surface *surface_object)
 {
-	int rc;
+	VAStatus status;
 
 	switch (profile) {
 	case VAProfileMPEG2Simple:
 	case VAProfileMPEG2Main:
-		rc = mpeg2_set_controls(driver_data, context, surface_object);
-		if (rc < 0)
-			return VA_STATUS_ERROR_OPERATION_FAILED;
+		status = mpeg2_set_controls(driver_data, context,
+					    surface_object);
+		if (status != VA_STATUS_SUCCESS)
+			return status;
 		break;
 
 	case VAProfileH264Main:
@@ -184,15 +285,17 @@ static VAStatus codec_set_controls(struct request_data *driver_data,
 	case VAProfileH264ConstrainedBaseline:
 	case VAProfileH264MultiviewHigh:
 	case VAProfileH264StereoHigh:
-		rc = h264_set_controls(driver_data, context, surface_object);
-		if (rc < 0)
-			return VA_STATUS_ERROR_OPERATION_FAILED;
+		status = h264_set_controls(driver_data, context,
+					   surface_object);
+		if (status != VA_STATUS_SUCCESS)
+			return status;
 		break;
 
 	case VAProfileHEVCMain:
-		rc = h265_set_controls(driver_data, context, surface_object);
-		if (rc < 0)
-			return VA_STATUS_ERROR_OPERATION_FAILED;
+		status = h265_set_controls(driver_data, context,
+					   surface_object);
+		if (status != VA_STATUS_SUCCESS)
+			return status;
 		break;
 
 	default:
@@ -202,12 +305,269 @@ static VAStatus codec_set_controls(struct request_data *driver_data,
 	return VA_STATUS_SUCCESS;
 }
 
+static VAStatus slice_data_copy_start_code(struct object_surface *surface_object,
+					   const void *data, unsigned int size)
+{
+	static const uint8_t start_code[SLICE_START_CODE_SIZE] = {
+		0x00, 0x00, 0x01
+	};
+	uint8_t *destination = surface_object->source_data;
+
+	if (surface_object->slices_size + sizeof(start_code) + size >
+	    surface_object->source_size)
+		return VA_STATUS_ERROR_NOT_ENOUGH_BUFFER;
+
+	memcpy(destination + surface_object->slices_size, start_code,
+	       sizeof(start_code));
+	surface_object->slices_size += sizeof(start_code);
+
+	memcpy(destination + surface_object->slices_size, data, size);
+	surface_object->slices_size += size;
+
+	return VA_STATUS_SUCCESS;
+}
+
+/*
+ * Each slice of the slice data buffer is copied after an Annex-B start code,
+ * and its parameters are updated to point at its new location.
+ */
+static VAStatus slice_data_store_start_codes(VAProfile profile,
+					     struct object_surface *surface_object,
+					     struct object_buffer *buffer_object)
+{
+	unsigned int base = surface_object->slices_size;
+	unsigned int size = buffer_object->size * buffer_object->count;
+	uint8_t *data = buffer_object->data;
+	uint32_t slice_size;
+	uint32_t *offset;
+	unsigned int i;
+	VAStatus status;
+
+	/* Without slice parameters, the buffer is taken as a single slice. */
+	if (surface_object->slices_data_count == surface_object->slices_count)
+		return slice_data_copy_start_code(surface_object, data, size);
+
+	for (i = surface_object->slices_data_count;
+	     i < surface_object->slices_count; i++) {
+		if (!slice_data_location(profile, surface_object->slices_params,
+					 i, &offset, &slice_size))
+			return VA_STATUS_ERROR_UNSUPPORTED_PROFILE;
+
+		if (*offset < base || *offset - base + slice_size > size)
+			return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+		status = slice_data_copy_start_code(surface_object,
+						    data + *offset - base,
+						    slice_size);
+		if (status != VA_STATUS_SUCCESS)
+			return status;
+
+		*offset = surface_object->slices_size - slice_size;
+	}
+
+	surface_object->slices_data_count = surface_object->slices_count;
+
+	return VA_STATUS_SUCCESS;
+}
+
+/*
+ * Slice data carved in submission order is already in place. Otherwise, the
+ * data gathered so far is moved to the surface OUTPUT buffer and the
+ * remaining slice data is copied after it.
+ */
+static bool slice_data_attach(struct object_context *context_object,
+			      struct object_surface *surface_object,
+			      struct object_buffer *buffer_object)
+{
+	struct context_output_buffer *buffer;
+	unsigned int size = buffer_object->size * buffer_object->count;
+
+	if (buffer_object->slice_buffer >= 0 &&
+	    buffer_object->context_id == context_object->base.id) {
+		if (surface_object->slices_size == 0 &&
+		    buffer_object->slice_offset == 0) {
+			surface_object->slices_buffer =
+				buffer_object->slice_buffer;
+			surface_object->slices_size = size;
+			return true;
+		}
+
+		if (surface_object->slices_buffer == buffer_object->slice_buffer &&
+		    surface_object->slices_size == buffer_object->slice_offset) {
+			surface_object->slices_size += size;
+			return true;
+		}
+	}
+
+	if (surface_object->slices_buffer >= 0) {
+		buffer = &context_object->slice_buffers[surface_object->slices_buffer];
+		memcpy(surface_object->source_data, buffer->data,
+		       surface_object->slices_size);
+		surface_object->slices_buffer = -1;
+	}
+
+	return false;
+}
+
+/*
+ * Slice data is copied to its own OUTPUT buffer and kept pending until the
+ * next slice shows up, since only the last slice of the picture may release
+ * the capture buffer.
+ */
+static VAStatus slice_store(struct request_data *driver_data,
+			    struct object_context *context_object,
+			    struct object_surface *surface_object,
+			    struct object_buffer *buffer_object)
+{
+	struct context_output_buffer *buffer;
+	unsigned int size = buffer_object->size * buffer_object->count;
+	unsigned int index;
+	VAStatus status;
+
+	if (context_object->slice_pending < 0) {
+		index = context_object->slice_buffers_index;
+		buffer = &context_object->slice_buffers[index];
+
+		status = context_output_buffer_reclaim(driver_data,
+						       context_object, buffer);
+		if (status != VA_STATUS_SUCCESS)
+			return status;
+
+		context_object->slice_buffers_index = (index + 1) %
+			context_object->slice_buffers_count;
+		context_object->slice_pending = index;
+
+		surface_object->slices_size = 0;
+	} else {
+		buffer = &context_object->slice_buffers[context_object->slice_pending];
+	}
+
+	if (surface_object->slices_size + size > buffer->size)
+		return VA_STATUS_ERROR_NOT_ENOUGH_BUFFER;
+
+	memcpy(buffer->data + surface_object->slices_size, buffer_object->data,
+	       size);
+	surface_object->slices_size += size;
+
+	return VA_STATUS_SUCCESS;
+}
+
+static VAStatus slice_submit(struct request_data *driver_data,
+			     struct object_context *context_object,
+			     VAProfile profile,
+			     struct object_surface *surface_object)
+{
+	struct video_format *video_format = driver_data->video_format;
+	struct context_output_buffer *buffer;
+	unsigned int capture_type;
+	bool output_queued = false;
+	VAStatus status;
+	int rc;
+
+	capture_type = v4l2_type_video_capture(video_format->v4l2_mplane);
+
+	buffer = &context_object->slice_buffers[context_object->slice_pending];
+
+	/* Codecs parsing the slice data find it through the slice buffer. */
+	surface_object->slices_buffer = context_object->slice_pending;
+	context_object->slice_pending = -1;
+
+	if (surface_object->slices_submitted == 0)
+		context_timestamp_next(context_object,
+				       &surface_object->timestamp);
+
+	status = surface_request_acquire(driver_data, surface_object);
+	if (status != VA_STATUS_SUCCESS)
+		goto error;
+
+	status = codec_set_controls(driver_data, context_object, profile,
+				    surface_object);
+	if (status != VA_STATUS_SUCCESS)
+		goto error;
+
+	surface_output_track(driver_data, buffer->index, VA_INVALID_ID);
+
+	rc = context_output_buffer_queue(driver_data, buffer,
+					 surface_object->request_fd,
+					 &surface_object->timestamp,
+					 surface_object->slices_size,
+					 V4L2_BUF_FLAG_M2M_HOLD_CAPTURE_BUF);
+	if (rc < 0) {
+		status = VA_STATUS_ERROR_OPERATION_FAILED;
+		goto error;
+	}
+
+	output_queued = true;
+
+	/*
+	 * The capture buffer is queued once, along with the first slice. It
+	 * comes last so that only the request itself failing to be queued
+	 * leaves it behind.
+	 */
+	if (surface_object->slices_submitted == 0) {
+		surface_buffers_track(driver_data, surface_object);
+
+		rc = v4l2_queue_buffer(driver_data->video_fd, -1, capture_type,
+				       NULL, surface_object->destination_index,
+				       0, surface_object->destination_buffers_count,
+				       0);
+		if (rc < 0) {
+			status = VA_STATUS_ERROR_OPERATION_FAILED;
+			goto error;
+		}
+	}
+
+	rc = media_request_queue(surface_object->request_fd);
+	if (rc < 0) {
+		status = VA_STATUS_ERROR_OPERATION_FAILED;
+		goto error;
+	}
+
+	buffer->request_fd = surface_object->request_fd;
+	surface_object->request_fd = -1;
+
+	surface_object->slices_submitted++;
+	surface_object->slices_size = 0;
+	surface_object->slices_count = 0;
+	surface_object->slices_data_count = 0;
+	surface_object->slices_buffer = -1;
+
+	return VA_STATUS_SUCCESS;
+
+error:
+	/* Buffers bound to a request that is not queued are given back. */
+	if (output_queued && buffer->index < VIDEO_MAX_FRAME)
+		driver_data->output_dequeued[buffer->index] = true;
+
+	surface_request_release(driver_data, surface_object);
+
+	/*
+	 * Release the capture buffer held by the slices submitted before, so
+	 * that the next picture does not end up in it, and drop the picture.
+	 */
+	if (surface_object->slices_submitted > 0)
+		v4l2_flush_decoder(driver_data->video_fd);
+
+	surface_object->slices_submitted = 0;
+	surface_object->slices_size = 0;
+	surface_object->slices_count = 0;
+	surface_object->slices_data_count = 0;
+	surface_object->slices_buffer = -1;
+
+	context_object->slice_pending = -1;
+
+	context_controls_cache_invalidate(context_object);
+
+	return status;
+}
+
 VAStatus RequestBeginPicture(VADriverContextP context, VAContextID context_id,
 			     VASurfaceID surface_id)
 {
 	struct request_data *driver_data = context->pDriverData;
 	struct object_context *context_object;
 	struct object_surface *surface_object;
+	VAStatus status;
 
 	context_object = CONTEXT(driver_data, context_id);
 	if (context_object == NULL)
@@ -220,6 +580,27 @@ VAStatus RequestBeginPicture(VADriverContextP context, VAContextID context_id,
 	if (surface_object->status == VASurfaceRendering)
 		RequestSyncSurface(context, surface_id);
 
+	status = context_source_bind(driver_data, context_object,
+				     surface_object);
+	if (status != VA_STATUS_SUCCESS)
+		return status;
+
+	/*
+	 * Slices left over by a picture that was not completed are dropped,
+	 * along with the capture buffer and request they may still hold.
+	 */
+	if (surface_object->slices_submitted > 0)
+		v4l2_flush_decoder(driver_data->video_fd);
+
+	if (!surface_object->request_queued)
+		surface_request_release(driver_data, surface_object);
+
+	surface_object->slices_size = 0;
+	surface_object->slices_count = 0;
+	surface_object->slices_data_count = 0;
+	surface_object->slices_submitted = 0;
+	surface_object->slices_buffer = -1;
+
 	surface_object->status = VASurfaceRendering;
 	context_object->render_surface_id = surface_id;
 
@@ -234,6 +615,7 @@ VAStatus RequestRenderPicture(VADriverContextP context, VAContextID context_id,
 	struct object_config *config_object;
 	struct object_surface *surface_object;
 	struct object_buffer *buffer_object;
+	unsigned int size;
 	int rc;
 	int i;
 
@@ -255,6 +637,63 @@ VAStatus RequestRenderPicture(VADriverContextP context, VAContextID context_id,
 		if (buffer_object == NULL)
 			return VA_STATUS_ERROR_INVALID_BUFFER;
 
+		if (context_object->slices_submit) {
+			/* A new slice starts: the pending one can be sent. */
+			if (buffer_object->type == VASliceParameterBufferType &&
+			    context_object->slice_pending >= 0) {
+				rc = slice_submit(driver_data, context_object,
+						  config_object->profile,
+						  surface_object);
+				if (rc != VA_STATUS_SUCCESS)
+					return rc;
+			}
+
+			if (buffer_object->type == VASliceDataBufferType) {
+				rc = slice_store(driver_data, context_object,
+						 surface_object, buffer_object);
+				if (rc != VA_STATUS_SUCCESS)
+					return rc;
+
+				continue;
+			}
+		}
+
+		if (context_object->slices_zero_copy &&
+		    buffer_object->type == VASliceDataBufferType &&
+		    slice_data_attach(context_object, surface_object,
+				      buffer_object))
+			continue;
+
+		/* Pictures larger than expected get a larger OUTPUT buffer. */
+		if (buffer_object->type == VASliceDataBufferType) {
+			size = surface_object->slices_size +
+			       buffer_object->size * buffer_object->count;
+
+			if (context_object->start_codes)
+				size += SLICE_START_CODE_SIZE *
+					(surface_object->slices_count -
+					 surface_object->slices_data_count + 1);
+
+			if (size > surface_object->source_size) {
+				rc = context_source_grow(driver_data,
+							 context_object,
+							 surface_object, size);
+				if (rc != VA_STATUS_SUCCESS)
+					return rc;
+			}
+		}
+
+		if (context_object->start_codes &&
+		    buffer_object->type == VASliceDataBufferType) {
+			rc = slice_data_store_start_codes(config_object->profile,
+							  surface_object,
+							  buffer_object);
+			if (rc != VA_STATUS_SUCCESS)
+				return rc;
+
+			continue;
+		}
+
 		rc = codec_store_buffer(driver_data, config_object->profile,
 					surface_object, buffer_object);
 		if (rc != VA_STATUS_SUCCESS)
@@ -271,7 +710,8 @@ VAStatus RequestEndPicture(VADriverContextP context, VAContextID context_id)
 	struct object_config *config_object;
 	struct object_surface *surface_object;
 	struct video_format *video_format;
-	unsigned int output_type, capture_type;
+	struct context_output_buffer *buffer;
+	bool output_tracked = false;
 	int request_fd;
 	VAStatus status;
 	int rc;
@@ -280,9 +720,6 @@ VAStatus RequestEndPicture(VADriverContextP context, VAContextID context_id)
 	if (video_format == NULL)
 		return VA_STATUS_ERROR_OPERATION_FAILED;
 
-	output_type = v4l2_type_video_output(video_format->v4l2_mplane);
-	capture_type = v4l2_type_video_capture(video_format->v4l2_mplane);
-
 	context_object = CONTEXT(driver_data, context_id);
 	if (context_object == NULL)
 		return VA_STATUS_ERROR_INVALID_CONTEXT;
@@ -296,42 +733,103 @@ VAStatus RequestEndPicture(VADriverContextP context, VAContextID context_id)
 	if (surface_object == NULL)
 		return VA_STATUS_ERROR_INVALID_SURFACE;
 
-	gettimeofday(&surface_object->timestamp, NULL);
+	if (surface_object->slices_submitted == 0)
+		context_timestamp_next(context_object,
+				       &surface_object->timestamp);
 
-	request_fd = surface_object->request_fd;
-	if (request_fd < 0) {
-		request_fd = media_request_alloc(driver_data->media_fd);
-		if (request_fd < 0)
-			return VA_STATUS_ERROR_OPERATION_FAILED;
+	if (surface_object->source_buffer < 0)
+		return VA_STATUS_ERROR_OPERATION_FAILED;
 
-		surface_object->request_fd = request_fd;
+	buffer = &context_object->source_buffers[surface_object->source_buffer];
+
+	/*
+	 * With per-slice submission, the last slice completes the picture. Its
+	 * data is then queued from its slice buffer, like carved slice data.
+	 */
+	if (context_object->slices_submit &&
+	    context_object->slice_pending >= 0) {
+		surface_object->slices_buffer = context_object->slice_pending;
+		context_object->slice_pending = -1;
 	}
 
-	rc = codec_set_controls(driver_data, context_object,
-				config_object->profile, surface_object);
-	if (rc != VA_STATUS_SUCCESS)
-		return rc;
+	/* Carved slice data is queued from the buffer it was written to. */
+	if (surface_object->slices_buffer >= 0) {
+		buffer = &context_object->slice_buffers[surface_object->slices_buffer];
+		buffer->surface_id = surface_object->base.id;
 
-	rc = v4l2_queue_buffer(driver_data->video_fd, -1, capture_type, NULL,
-			       surface_object->destination_index, 0,
-			       surface_object->destination_buffers_count);
-	if (rc < 0)
-		return VA_STATUS_ERROR_OPERATION_FAILED;
+		if (context_object->slice_carved == surface_object->slices_buffer)
+			context_object->slice_carved = -1;
+	}
 
-	rc = v4l2_queue_buffer(driver_data->video_fd, request_fd, output_type,
-			       &surface_object->timestamp,
-			       surface_object->source_index,
-			       surface_object->slices_size, 1);
-	if (rc < 0)
-		return VA_STATUS_ERROR_OPERATION_FAILED;
+	status = surface_request_acquire(driver_data, surface_object);
+	if (status != VA_STATUS_SUCCESS)
+		goto error;
 
-	surface_object->slices_size = 0;
+	request_fd = surface_object->request_fd;
 
-	status = RequestSyncSurface(context, context_object->render_surface_id);
+	status = codec_set_controls(driver_data, context_object,
+				    config_object->profile, surface_object);
 	if (status != VA_STATUS_SUCCESS)
-		return status;
+		goto error;
+
+	surface_object->output_index = buffer->index;
+
+	surface_output_track(driver_data, surface_object->output_index,
+			     surface_object->base.id);
+	output_tracked = true;
+
+	rc = context_output_buffer_queue(driver_data, buffer,
+					 request_fd, &surface_object->timestamp,
+					 surface_object->slices_size, 0);
+	if (rc < 0) {
+		status = VA_STATUS_ERROR_OPERATION_FAILED;
+		goto error;
+	}
+
+	/*
+	 * Only queue the request here: waiting for completion and dequeuing
+	 * is left to the consumers of the surface, so that several frames
+	 * can be in flight.
+	 */
+	surface_object->context_id = context_id;
+
+	status = surface_request_queue(driver_data, surface_object);
+	if (status != VA_STATUS_SUCCESS)
+		goto error;
+
+	surface_object->slices_size = 0;
+	surface_object->slices_count = 0;
+	surface_object->slices_data_count = 0;
+	surface_object->slices_submitted = 0;
+	surface_object->slices_buffer = -1;
 
 	context_object->render_surface_id = VA_INVALID_ID;
 
 	return VA_STATUS_SUCCESS;
+
+error:
+	/* Buffers bound to a request that is not queued are given back. */
+	if (output_tracked && buffer->index < VIDEO_MAX_FRAME) {
+		driver_data->output_surfaces_ids[buffer->index] = VA_INVALID_ID;
+		driver_data->output_dequeued[buffer->index] = true;
+	}
+
+	surface_object->output_index = VIDEO_MAX_FRAME;
+
+	surface_request_release(driver_data, surface_object);
+
+	/* Release the capture buffer held by the slices submitted before. */
+	if (surface_object->slices_submitted > 0)
+		v4l2_flush_decoder(driver_data->video_fd);
+
+	surface_object->slices_submitted = 0;
+
+	/* The picture is lost, but the surface can be rendered again. */
+	surface_object->status = VASurfaceReady;
+	surface_object->destination_error = true;
+
+	/* The controls left out of the next request must not rely on these. */
+	context_controls_cache_invalidate(context_object);
+
+	return status;
 }
@@ -31,6 +31,8 @@
 
 #include "object_heap.h"
 
+#define SLICE_START_CODE_SIZE	3
+
 VAStatus RequestBeginPicture(VADriverContextP context, VAContextID context_id,
 			     VASurfaceID surface_id);
 VAStatus RequestRenderPicture(VADriverContextP context, VAContextID context_id,
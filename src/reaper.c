@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2019 Bootlin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+
+#include "media.h"
+#include "reaper.h"
+#include "request.h"
+#include "surface.h"
+#include "utils.h"
+
+/*
+ * The reaper is an optional thread that watches all the queued media requests
+ * and retires them as soon as they complete, so that the surface status is
+ * always up to date and syncing a decoded surface does not involve any
+ * system call.
+ */
+
+#define REAPER_STOP_COOKIE		0
+
+static void *reaper_thread(void *data)
+{
+	struct request_data *driver_data = data;
+	uint64_t cookies[MEDIA_WAITER_EVENTS_MAX];
+	bool stop = false;
+	int count;
+	int i;
+
+	while (!stop) {
+		count = media_waiter_wait(driver_data->waiter_fd, cookies,
+					  MEDIA_WAITER_EVENTS_MAX, -1);
+		if (count < 0)
+			break;
+
+		pthread_mutex_lock(&driver_data->mutex);
+
+		stop = driver_data->reaper_stop;
+
+		for (i = 0; i < count && !stop; i++)
+			if (cookies[i] != REAPER_STOP_COOKIE)
+				surface_request_reap(driver_data, cookies[i]);
+
+		pthread_cond_broadcast(&driver_data->cond);
+		pthread_mutex_unlock(&driver_data->mutex);
+	}
+
+	return NULL;
+}
+
+int reaper_start(struct request_data *driver_data)
+{
+	int rc;
+
+	driver_data->reaper_stop = false;
+
+	driver_data->reaper_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (driver_data->reaper_event_fd < 0) {
+		request_log("Unable to create reaper event: %s\n",
+			    strerror(errno));
+		return -1;
+	}
+
+	rc = media_waiter_add(driver_data->waiter_fd,
+			      driver_data->reaper_event_fd, REAPER_STOP_COOKIE);
+	if (rc < 0)
+		goto error;
+
+	rc = pthread_create(&driver_data->reaper_thread, NULL, reaper_thread,
+			    driver_data);
+	if (rc != 0) {
+		request_log("Unable to create reaper thread: %s\n",
+			    strerror(rc));
+		media_waiter_remove(driver_data->waiter_fd,
+				    driver_data->reaper_event_fd);
+		goto error;
+	}
+
+	driver_data->reaper_enabled = true;
+
+	return 0;
+
+error:
+	close(driver_data->reaper_event_fd);
+	driver_data->reaper_event_fd = -1;
+
+	return -1;
+}
+
+void reaper_stop(struct request_data *driver_data)
+{
+	uint64_t value = 1;
+	ssize_t length;
+
+	if (!driver_data->reaper_enabled)
+		return;
+
+	pthread_mutex_lock(&driver_data->mutex);
+	driver_data->reaper_stop = true;
+	pthread_mutex_unlock(&driver_data->mutex);
+
+	length = write(driver_data->reaper_event_fd, &value, sizeof(value));
+	if (length != sizeof(value))
+		request_log("Unable to signal reaper thread: %s\n",
+			    strerror(errno));
+
+	pthread_join(driver_data->reaper_thread, NULL);
+
+	media_waiter_remove(driver_data->waiter_fd,
+			    driver_data->reaper_event_fd);
+	close(driver_data->reaper_event_fd);
+
+	driver_data->reaper_event_fd = -1;
+	driver_data->reaper_enabled = false;
+}
+
+static void reaper_deadline(struct timespec *deadline, uint64_t time)
+{
+	deadline->tv_sec = time / 1000000;
+	deadline->tv_nsec = (time % 1000000) * 1000;
+}
+
+int reaper_wait(struct request_data *driver_data,
+		struct object_surface *surface_object, int timeout,
+		uint64_t limit)
+{
+	struct timespec deadline;
+	uint64_t time;
+	int rc;
+
+	/*
+	 * The timeout applies to each completion, not to the whole queue.
+	 * Reaching the caller's limit is not an error: the surface is simply
+	 * left rendering.
+	 */
+	while (surface_object->status == VASurfaceRendering &&
+	       surface_object->request_queued) {
+		time = request_time_us() + (uint64_t)timeout * 1000;
+		if (limit != 0 && limit < time)
+			time = limit;
+
+		reaper_deadline(&deadline, time);
+
+		rc = pthread_cond_timedwait(&driver_data->cond,
+					    &driver_data->mutex, &deadline);
+		if (rc == ETIMEDOUT) {
+			if (limit != 0 && request_time_us() >= limit)
+				return 0;
+
+			request_log("Timeout when waiting for media request\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2018 Paul Kocialkowski <paul.kocialkowski@bootlin.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include <linux/videodev2.h>
+
+#include "object_heap.h"
+#include "ref.h"
+#include "surface.h"
+
+/* Surface IDs of a context are usually contiguous, keeping the table small. */
+int ref_manager_init(struct ref_manager *refs,
+		     struct object_heap *surface_heap,
+		     VASurfaceID *surfaces_ids, int surfaces_count)
+{
+	struct ref_entry *entry;
+	VASurfaceID id_min, id_max;
+	unsigned int i;
+
+	refs->entries = NULL;
+	refs->entries_count = 0;
+	refs->id_base = 0;
+	refs->surface_heap = surface_heap;
+
+	if (surfaces_count <= 0)
+		return 0;
+
+	id_min = id_max = surfaces_ids[0];
+
+	for (i = 1; i < (unsigned int)surfaces_count; i++) {
+		if (surfaces_ids[i] < id_min)
+			id_min = surfaces_ids[i];
+		if (surfaces_ids[i] > id_max)
+			id_max = surfaces_ids[i];
+	}
+
+	refs->entries = calloc(id_max - id_min + 1, sizeof(*refs->entries));
+	if (refs->entries == NULL)
+		return -1;
+
+	refs->entries_count = id_max - id_min + 1;
+	refs->id_base = id_min;
+
+	for (i = 0; i < refs->entries_count; i++) {
+		refs->entries[i].surface_id = VA_INVALID_SURFACE;
+		refs->entries[i].slot = -1;
+	}
+
+	for (i = 0; i < (unsigned int)surfaces_count; i++) {
+		entry = &refs->entries[surfaces_ids[i] - refs->id_base];
+		if (entry->surface_object != NULL)
+			continue;
+
+		entry->surface_id = surfaces_ids[i];
+		entry->surface_object = (struct object_surface *)
+			object_heap_lookup(surface_heap, surfaces_ids[i]);
+		if (entry->surface_object != NULL)
+			entry->surface_object->refs_count++;
+	}
+
+	return 0;
+}
+
+void ref_manager_cleanup(struct ref_manager *refs)
+{
+	unsigned int i;
+
+	for (i = 0; i < refs->entries_count; i++)
+		if (refs->entries[i].surface_object != NULL)
+			refs->entries[i].surface_object->refs_count--;
+
+	free(refs->entries);
+
+	refs->entries = NULL;
+	refs->entries_count = 0;
+}
+
+/* Only render targets of the context have an entry. */
+struct ref_entry *ref_lookup(struct ref_manager *refs, VASurfaceID id)
+{
+	struct ref_entry *entry;
+
+	if (refs->entries == NULL || id == VA_INVALID_SURFACE ||
+	    id < refs->id_base || id - refs->id_base >= refs->entries_count)
+		return NULL;
+
+	entry = &refs->entries[id - refs->id_base];
+	if (entry->surface_id != id)
+		return NULL;
+
+	return entry;
+}
+
+/* Drops the reference on a surface that is being destroyed. */
+void ref_invalidate(struct ref_manager *refs, VASurfaceID id)
+{
+	struct ref_entry *entry;
+
+	entry = ref_lookup(refs, id);
+	if (entry == NULL || entry->surface_object == NULL)
+		return;
+
+	entry->surface_object->refs_count--;
+	entry->surface_object = NULL;
+	entry->surface_id = VA_INVALID_SURFACE;
+	entry->slot = -1;
+}
+
+bool ref_timestamp(struct ref_manager *refs, VASurfaceID id,
+		   uint64_t *timestamp)
+{
+	struct object_surface *surface_object;
+	struct ref_entry *entry;
+
+	if (id == VA_INVALID_SURFACE)
+		return false;
+
+	entry = ref_lookup(refs, id);
+	if (entry != NULL)
+		surface_object = entry->surface_object;
+	else
+		surface_object = (struct object_surface *)
+			object_heap_lookup(refs->surface_heap, id);
+
+	if (surface_object == NULL)
+		return false;
+
+	*timestamp = v4l2_timeval_to_ns(&surface_object->timestamp);
+
+	return true;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2018 Paul Kocialkowski <paul.kocialkowski@bootlin.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _REF_H_
+#define _REF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <va/va.h>
+
+struct object_heap;
+struct object_surface;
+
+/* Reference picture: a render target of the context. */
+struct ref_entry {
+	VASurfaceID surface_id;
+	/* Referenced surface, NULL once destroyed. */
+	struct object_surface *surface_object;
+	/* Slot of the picture in the codec DPB, negative when not in it. */
+	int slot;
+};
+
+/*
+ * Render targets are indexed by surface ID, so that their DPB slot and
+ * timestamp are found in constant time and without locking the surface heap.
+ * Each of them holds a reference on its surface, dropped when it is destroyed.
+ */
+struct ref_manager {
+	struct ref_entry *entries;
+	unsigned int entries_count;
+	VASurfaceID id_base;
+
+	/* Fallback for references that are not render targets. */
+	struct object_heap *surface_heap;
+};
+
+int ref_manager_init(struct ref_manager *refs,
+		     struct object_heap *surface_heap,
+		     VASurfaceID *surfaces_ids, int surfaces_count);
+void ref_manager_cleanup(struct ref_manager *refs);
+struct ref_entry *ref_lookup(struct ref_manager *refs, VASurfaceID id);
+void ref_invalidate(struct ref_manager *refs, VASurfaceID id);
+bool ref_timestamp(struct ref_manager *refs, VASurfaceID id,
+		   uint64_t *timestamp);
+
+#endif
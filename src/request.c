@@ -27,6 +27,7 @@
 #include "buffer.h"
 #include "config.h"
 #include "context.h"
+#include "control.h"
 #include "image.h"
 #include "picture.h"
 #include "subpicture.h"
@@ -36,6 +37,10 @@
 
 #include <va/va_backend.h>
 
+#include "detile.h"
+#include "dma_heap.h"
+#include "media.h"
+#include "reaper.h"
 #include "request.h"
 #include "utils.h"
 #include "v4l2.h"
@@ -47,6 +52,7 @@
 #include <fcntl.h>
 #include <stdarg.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <sys/ioctl.h>
@@ -61,6 +67,7 @@ VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP context)
 {
 	struct request_data *driver_data;
 	struct VADriverVTable *vtable = context->vtable;
+	pthread_condattr_t condattr;
 	VAStatus status;
 	unsigned int capabilities;
 	unsigned int capabilities_required;
@@ -68,6 +75,10 @@ VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP context)
 	int media_fd = -1;
 	char *video_path;
 	char *media_path;
+	char *dma_heap_path;
+	char *reaper;
+	char *detile_threads;
+	char *timeout;
 	int rc;
 
 	context->version_major = VA_MAJOR_VERSION;
@@ -106,6 +117,9 @@ VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP context)
 	vtable->vaRenderPicture = RequestRenderPicture;
 	vtable->vaEndPicture = RequestEndPicture;
 	vtable->vaSyncSurface = RequestSyncSurface;
+#if VA_CHECK_VERSION(1, 9, 0)
+	vtable->vaSyncSurface2 = RequestSyncSurface2;
+#endif
 	vtable->vaQuerySurfaceAttributes = RequestQuerySurfaceAttributes;
 	vtable->vaQuerySurfaceStatus = RequestQuerySurfaceStatus;
 	vtable->vaPutSurface = RequestPutSurface;
@@ -135,6 +149,14 @@ VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP context)
 
 	context->pDriverData = driver_data;
 
+	pthread_mutex_init(&driver_data->mutex, NULL);
+
+	/* Waits are bounded, keep them unaffected by wall clock changes. */
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&driver_data->cond, &condattr);
+	pthread_condattr_destroy(&condattr);
+
 	object_heap_init(&driver_data->config_heap,
 			 sizeof(struct object_config), CONFIG_ID_OFFSET);
 	object_heap_init(&driver_data->context_heap,
@@ -179,6 +201,49 @@ VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP context)
 	driver_data->video_fd = video_fd;
 	driver_data->media_fd = media_fd;
 
+	control_table_init(driver_data);
+
+	driver_data->waiter_fd = media_waiter_create();
+	if (driver_data->waiter_fd < 0) {
+		status = VA_STATUS_ERROR_OPERATION_FAILED;
+		goto error;
+	}
+
+	timeout = getenv("LIBVA_V4L2_REQUEST_TIMEOUT");
+	if (timeout != NULL)
+		driver_data->request_timeout = atoi(timeout);
+
+	driver_data->stats_enabled =
+		getenv("LIBVA_V4L2_REQUEST_STATS") != NULL;
+
+	driver_data->output_memory = V4L2_MEMORY_MMAP;
+	driver_data->dma_heap_fd = -1;
+
+	if (getenv("LIBVA_V4L2_REQUEST_OUTPUT_DMABUF") != NULL) {
+		dma_heap_path = getenv("LIBVA_V4L2_REQUEST_DMA_HEAP_PATH");
+		if (dma_heap_path == NULL)
+			dma_heap_path = DMA_HEAP_PATH_DEFAULT;
+
+		driver_data->dma_heap_fd = dma_heap_open(dma_heap_path);
+		if (driver_data->dma_heap_fd < 0)
+			request_log("Unable to open DMA heap, falling back to MMAP OUTPUT buffers\n");
+	}
+
+	reaper = getenv("LIBVA_V4L2_REQUEST_REAPER");
+	if (reaper != NULL && strcmp(reaper, "0") != 0) {
+		rc = reaper_start(driver_data);
+		if (rc < 0)
+			request_log("Unable to start reaper, falling back to synchronous completion\n");
+	}
+
+	detile_threads = getenv("LIBVA_V4L2_REQUEST_DETILE_THREADS");
+	if (detile_threads != NULL) {
+		rc = detile_pool_start(&driver_data->detile_pool,
+				       atoi(detile_threads));
+		if (rc < 0)
+			request_log("Unable to start detile threads, converting images on the calling thread\n");
+	}
+
 	status = VA_STATUS_SUCCESS;
 	goto complete;
 
@@ -205,9 +270,18 @@ VAStatus RequestTerminate(VADriverContextP context)
 	struct object_config *config_object;
 	int iterator;
 
+	reaper_stop(driver_data);
+	detile_pool_stop(&driver_data->detile_pool);
+
+	media_request_pool_empty(&driver_data->request_pool);
+
+	close(driver_data->waiter_fd);
 	close(driver_data->video_fd);
 	close(driver_data->media_fd);
 
+	if (driver_data->dma_heap_fd >= 0)
+		close(driver_data->dma_heap_fd);
+
 	/* Cleanup leftover buffers. */
 
 	image_object = (struct object_image *)
@@ -264,6 +338,9 @@ VAStatus RequestTerminate(VADriverContextP context)
 
 	object_heap_destroy(&driver_data->config_heap);
 
+	pthread_cond_destroy(&driver_data->cond);
+	pthread_mutex_destroy(&driver_data->mutex);
+
 	free(context->pDriverData);
 	context->pDriverData = NULL;
 
@@ -27,9 +27,14 @@
 #ifndef _V4L2_REQUEST_H_
 #define _V4L2_REQUEST_H_
 
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "context.h"
+#include "control.h"
+#include "detile.h"
+#include "media.h"
 #include "object_heap.h"
 #include "video.h"
 #include <va/va.h>
@@ -55,6 +60,48 @@ struct request_data {
 	int media_fd;
 
 	struct video_format *video_format;
+
+	/* Codec controls exposed by the driver. */
+	struct control_info controls[CONTROLS_MAX];
+	unsigned int controls_count;
+
+	/* Surfaces with a queued media request, in submission order. */
+	VASurfaceID queued_surfaces_ids[VIDEO_MAX_FRAME];
+	unsigned int queued_index;
+	unsigned int queued_count;
+	unsigned int queued_sequence;
+
+	/* Surfaces owning the buffers queued on each queue, by V4L2 index. */
+	VASurfaceID output_surfaces_ids[VIDEO_MAX_FRAME];
+	VASurfaceID capture_surfaces_ids[VIDEO_MAX_FRAME];
+	bool output_dequeued[VIDEO_MAX_FRAME];
+
+	/* Memory of the OUTPUT buffers, dmabufs coming from the DMA heap. */
+	unsigned int output_memory;
+	int dma_heap_fd;
+
+	/* Reinitialized media requests, ready to be used again. */
+	struct media_request_pool request_pool;
+
+	/* Epoll set watching all the queued media requests. */
+	int waiter_fd;
+
+	/* Fixed media request timeout in ms, adaptive when zero. */
+	int request_timeout;
+	bool stats_enabled;
+	uint64_t completion_time;
+
+	/* Protects the queue and surface status against the reaper. */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	bool reaper_enabled;
+	bool reaper_stop;
+	pthread_t reaper_thread;
+	int reaper_event_fd;
+
+	/* Worker threads converting tiled surfaces to images. */
+	struct detile_pool detile_pool;
 };
 
 VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP context);
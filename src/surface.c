@@ -24,6 +24,7 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include "context.h"
 #include "request.h"
 #include "surface.h"
 
@@ -42,6 +43,7 @@
 #include <linux/videodev2.h>
 
 #include "media.h"
+#include "reaper.h"
 #include "utils.h"
 #include "v4l2.h"
 #include "video.h"
@@ -93,7 +95,8 @@ VAStatus RequestCreateSurfaces2(VADriverContextP context, unsigned int format,
 		capture_type = v4l2_type_video_capture(video_format->v4l2_mplane);
 
 		rc = v4l2_set_format(driver_data->video_fd, capture_type,
-				     video_format->v4l2_format, width, height);
+				     video_format->v4l2_format, width, height,
+				     0);
 		if (rc < 0)
 			return VA_STATUS_ERROR_OPERATION_FAILED;
         } else {
@@ -110,7 +113,8 @@ VAStatus RequestCreateSurfaces2(VADriverContextP context, unsigned int format,
 	destination_planes_count = video_format->planes_count;
 
 	rc = v4l2_create_buffers(driver_data->video_fd, capture_type,
-				 surfaces_count, &index_base);
+				 V4L2_MEMORY_MMAP, surfaces_count, 0,
+				 &index_base);
 	if (rc < 0)
 		return VA_STATUS_ERROR_ALLOCATION_FAILED;
 
@@ -184,6 +188,7 @@ VAStatus RequestCreateSurfaces2(VADriverContextP context, unsigned int format,
 		surface_object->width = width;
 		surface_object->height = height;
 
+		surface_object->source_buffer = -1;
 		surface_object->source_index = 0;
 		surface_object->source_data = NULL;
 		surface_object->source_size = 0;
@@ -198,9 +203,17 @@ VAStatus RequestCreateSurfaces2(VADriverContextP context, unsigned int format,
 		memset(&surface_object->params, 0,
 		       sizeof(surface_object->params));
 		surface_object->slices_count = 0;
+		surface_object->slices_data_count = 0;
 		surface_object->slices_size = 0;
+		surface_object->slices_submitted = 0;
+		surface_object->slices_params = NULL;
+		surface_object->slices_params_size = 0;
+		surface_object->slices_buffer = -1;
 
 		surface_object->request_fd = -1;
+		surface_object->request_queued = false;
+		surface_object->destination_error = false;
+		surface_object->refs_count = 0;
 
 		surfaces_ids[i] = id;
 	}
@@ -221,17 +234,29 @@ VAStatus RequestDestroySurfaces(VADriverContextP context,
 {
 	struct request_data *driver_data = context->pDriverData;
 	struct object_surface *surface_object;
+	struct object_context *context_object;
 	unsigned int i, j;
+	int iterator;
 
 	for (i = 0; i < surfaces_count; i++) {
 		surface_object = SURFACE(driver_data, surfaces_ids[i]);
 		if (surface_object == NULL)
 			return VA_STATUS_ERROR_INVALID_SURFACE;
 
-		if (surface_object->source_data != NULL &&
-		    surface_object->source_size > 0)
-			munmap(surface_object->source_data,
-			       surface_object->source_size);
+		if (surface_object->status == VASurfaceRendering)
+			RequestSyncSurface(context, surfaces_ids[i]);
+
+		/* Contexts still referencing the surface let go of it. */
+		context_object = (struct object_context *)
+			object_heap_first(&driver_data->context_heap, &iterator);
+		while (context_object != NULL &&
+		       surface_object->refs_count > 0) {
+			ref_invalidate(&context_object->refs, surfaces_ids[i]);
+
+			context_object = (struct object_context *)
+				object_heap_next(&driver_data->context_heap,
+						 &iterator);
+		}
 
 		for (j = 0; j < surface_object->destination_buffers_count; j++)
 			if (surface_object->destination_map[j] != NULL &&
@@ -239,9 +264,11 @@ VAStatus RequestDestroySurfaces(VADriverContextP context,
 				munmap(surface_object->destination_map[j],
 				       surface_object->destination_map_lengths[j]);
 
-		if (surface_object->request_fd > 0)
+		if (surface_object->request_fd >= 0)
 			close(surface_object->request_fd);
 
+		free(surface_object->slices_params);
+
 		object_heap_free(&driver_data->surface_heap,
 				 (struct object_base *)surface_object);
 	}
@@ -249,90 +276,708 @@ VAStatus RequestDestroySurfaces(VADriverContextP context,
 	return VA_STATUS_SUCCESS;
 }
 
-VAStatus RequestSyncSurface(VADriverContextP context, VASurfaceID surface_id)
+static int surface_request_timeout(struct request_data *driver_data,
+				   struct object_surface *surface_object)
 {
-	struct request_data *driver_data = context->pDriverData;
+	struct object_context *context_object;
+
+	context_object = CONTEXT(driver_data, surface_object->context_id);
+
+	return context_request_timeout(driver_data, context_object);
+}
+
+static void surface_request_account(struct request_data *driver_data,
+				    struct object_surface *surface_object)
+{
+	struct object_context *context_object;
+	uint64_t start, now;
+
+	now = request_time_us();
+
+	/*
+	 * Requests are decoded one after the other, so decoding starts when
+	 * the previous one completed. Completion is only noticed when the
+	 * request is retired, which can only make the estimate larger.
+	 */
+	start = surface_object->request_time;
+	if (driver_data->completion_time > start)
+		start = driver_data->completion_time;
+
+	driver_data->completion_time = now;
+
+	context_object = CONTEXT(driver_data, surface_object->context_id);
+	if (context_object != NULL)
+		context_decode_time_account(context_object, now - start);
+}
+
+static int surface_buffer_dequeue(struct request_data *driver_data,
+				  bool output)
+{
+	struct video_format *video_format = driver_data->video_format;
 	struct object_surface *surface_object;
-	VAStatus status;
-	struct video_format *video_format;
-	unsigned int output_type, capture_type;
-	int request_fd = -1;
+	VASurfaceID surface_id;
+	unsigned int buffers_count;
+	unsigned int type;
+	unsigned int memory;
+	unsigned int index;
+	unsigned int flags;
 	int rc;
 
-	video_format = driver_data->video_format;
-	if (video_format == NULL) {
-		status = VA_STATUS_ERROR_OPERATION_FAILED;
-		goto error;
+	if (output) {
+		type = v4l2_type_video_output(video_format->v4l2_mplane);
+		memory = driver_data->output_memory;
+		buffers_count = 1;
+	} else {
+		type = v4l2_type_video_capture(video_format->v4l2_mplane);
+		memory = V4L2_MEMORY_MMAP;
+		buffers_count = video_format->v4l2_buffers_count;
 	}
 
-	output_type = v4l2_type_video_output(video_format->v4l2_mplane);
-	capture_type = v4l2_type_video_capture(video_format->v4l2_mplane);
+	rc = v4l2_dequeue_buffer(driver_data->video_fd, -1, type, memory,
+				 buffers_count, &index, &flags);
+	if (rc < 0)
+		return -1;
 
-	surface_object = SURFACE(driver_data, surface_id);
-	if (surface_object == NULL) {
-		status = VA_STATUS_ERROR_INVALID_SURFACE;
-		goto error;
+	if (index >= VIDEO_MAX_FRAME)
+		return 0;
+
+	if (output) {
+		driver_data->output_dequeued[index] = true;
+		surface_id = driver_data->output_surfaces_ids[index];
+	} else {
+		surface_id = driver_data->capture_surfaces_ids[index];
 	}
 
-	if (surface_object->status != VASurfaceRendering) {
-		status = VA_STATUS_SUCCESS;
-		goto complete;
+	surface_object = SURFACE(driver_data, surface_id);
+	if (surface_object == NULL)
+		return 0;
+
+	if (output) {
+		surface_object->source_dequeued = true;
+	} else {
+		surface_object->destination_dequeued = true;
+		surface_object->destination_error =
+			(flags & V4L2_BUF_FLAG_ERROR) != 0;
 	}
 
+	return 0;
+}
+
+static VAStatus surface_request_complete(struct request_data *driver_data,
+					 struct object_surface *surface_object)
+{
+	VAStatus status;
+	int request_fd;
+	int timeout;
+	int rc;
+
 	request_fd = surface_object->request_fd;
-	if (request_fd < 0) {
-		status = VA_STATUS_ERROR_OPERATION_FAILED;
-		goto error;
-	}
+	if (request_fd < 0)
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	surface_object->request_queued = false;
+
+	media_waiter_remove(driver_data->waiter_fd, request_fd);
 
-	rc = media_request_queue(request_fd);
+	timeout = surface_request_timeout(driver_data, surface_object);
+
+	rc = media_request_wait_completion(request_fd, timeout);
 	if (rc < 0) {
 		status = VA_STATUS_ERROR_OPERATION_FAILED;
 		goto error;
 	}
 
-	rc = media_request_wait_completion(request_fd);
+	surface_request_account(driver_data, surface_object);
+
+	rc = media_request_reinit(request_fd);
 	if (rc < 0) {
 		status = VA_STATUS_ERROR_OPERATION_FAILED;
 		goto error;
 	}
 
+	media_request_pool_put(&driver_data->request_pool, request_fd);
+	surface_object->request_fd = -1;
+
+	/*
+	 * Buffers are not necessarily dequeued in request order: keep going
+	 * until ours show up, marking the others on the way.
+	 */
+	while (!surface_object->source_dequeued) {
+		rc = surface_buffer_dequeue(driver_data, true);
+		if (rc < 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+	}
+
+	while (!surface_object->destination_dequeued) {
+		rc = surface_buffer_dequeue(driver_data, false);
+		if (rc < 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+	}
+
+	surface_object->status = VASurfaceDisplaying;
+
+	return VA_STATUS_SUCCESS;
+
+error:
+	close(request_fd);
+	surface_object->request_fd = -1;
+
+	return status;
+}
+
+static struct object_surface *surface_request_pop(struct request_data *driver_data)
+{
+	struct object_context *context_object;
+	struct object_surface *surface_object;
+	VASurfaceID surface_id;
+
+	surface_id = driver_data->queued_surfaces_ids[driver_data->queued_index];
+
+	driver_data->queued_index = (driver_data->queued_index + 1) %
+				    VIDEO_MAX_FRAME;
+	driver_data->queued_count--;
+
+	surface_object = SURFACE(driver_data, surface_id);
+	if (surface_object == NULL)
+		return NULL;
+
+	context_object = CONTEXT(driver_data, surface_object->context_id);
+	if (context_object != NULL && context_object->queued_count > 0)
+		context_object->queued_count--;
+
+	return surface_object;
+}
+
+static VAStatus surface_request_retire(struct request_data *driver_data)
+{
+	struct object_surface *surface_object;
+
+	if (driver_data->queued_count == 0)
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	surface_object = surface_request_pop(driver_data);
+	if (surface_object == NULL)
+		return VA_STATUS_ERROR_INVALID_SURFACE;
+
+	return surface_request_complete(driver_data, surface_object);
+}
+
+void *surface_slice_params(struct object_surface *surface_object,
+			   unsigned int index, unsigned int size)
+{
+	unsigned int params_size = (index + 1) * size;
+	void *params;
+
+	if (params_size > surface_object->slices_params_size) {
+		if (params_size < surface_object->slices_params_size * 2)
+			params_size = surface_object->slices_params_size * 2;
+
+		params = realloc(surface_object->slices_params, params_size);
+		if (params == NULL)
+			return NULL;
+
+		surface_object->slices_params = params;
+		surface_object->slices_params_size = params_size;
+	}
+
+	return (char *)surface_object->slices_params + index * size;
+}
+
+void surface_output_track(struct request_data *driver_data, unsigned int index,
+			  VASurfaceID surface_id)
+{
+	if (index >= VIDEO_MAX_FRAME)
+		return;
+
+	driver_data->output_surfaces_ids[index] = surface_id;
+	driver_data->output_dequeued[index] = false;
+}
+
+void surface_buffers_track(struct request_data *driver_data,
+			   struct object_surface *surface_object)
+{
+	VASurfaceID surface_id = surface_object->base.id;
+
+	if (surface_object->destination_index < VIDEO_MAX_FRAME)
+		driver_data->capture_surfaces_ids[surface_object->destination_index] =
+			surface_id;
+
+	surface_object->source_dequeued = false;
+	surface_object->destination_dequeued = false;
+	surface_object->destination_error = false;
+}
+
+VAStatus surface_request_acquire(struct request_data *driver_data,
+				 struct object_surface *surface_object)
+{
+	int request_fd;
+
+	if (surface_object->request_fd >= 0)
+		return VA_STATUS_SUCCESS;
+
+	pthread_mutex_lock(&driver_data->mutex);
+	request_fd = media_request_pool_get(&driver_data->request_pool,
+					    driver_data->media_fd);
+	pthread_mutex_unlock(&driver_data->mutex);
+
+	if (request_fd < 0)
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	surface_object->request_fd = request_fd;
+
+	return VA_STATUS_SUCCESS;
+}
+
+/* Give back a request that was never queued, with its controls dropped. */
+void surface_request_release(struct request_data *driver_data,
+			     struct object_surface *surface_object)
+{
+	int request_fd = surface_object->request_fd;
+	int rc;
+
+	if (request_fd < 0)
+		return;
+
+	surface_object->request_fd = -1;
+
 	rc = media_request_reinit(request_fd);
 	if (rc < 0) {
+		close(request_fd);
+		return;
+	}
+
+	pthread_mutex_lock(&driver_data->mutex);
+	media_request_pool_put(&driver_data->request_pool, request_fd);
+	pthread_mutex_unlock(&driver_data->mutex);
+}
+
+static VAStatus surface_sync_locked(struct request_data *driver_data,
+				    struct object_surface *surface_object,
+				    uint64_t limit);
+
+/* Oldest queued request of the context, or of all of them without one. */
+static struct object_surface *surface_request_oldest(struct request_data *driver_data,
+						     struct object_context *context_object)
+{
+	struct object_surface *surface_object;
+	VASurfaceID surface_id;
+	unsigned int i;
+
+	for (i = 0; i < driver_data->queued_count; i++) {
+		surface_id = driver_data->queued_surfaces_ids[(driver_data->queued_index + i) %
+							      VIDEO_MAX_FRAME];
+
+		surface_object = SURFACE(driver_data, surface_id);
+		if (surface_object == NULL || !surface_object->request_queued)
+			continue;
+
+		if (context_object == NULL ||
+		    surface_object->context_id == context_object->base.id)
+			return surface_object;
+	}
+
+	return NULL;
+}
+
+/*
+ * A capture buffer queued without its request would be taken by the next
+ * request, and it cannot be dequeued on its own. It is given back by stopping
+ * the capture queue, once the requests in flight have completed.
+ */
+static int surface_capture_reclaim(struct request_data *driver_data)
+{
+	struct video_format *video_format = driver_data->video_format;
+	struct object_surface *oldest;
+	unsigned int capture_type;
+	int rc;
+
+	capture_type = v4l2_type_video_capture(video_format->v4l2_mplane);
+
+	while ((oldest = surface_request_oldest(driver_data, NULL)) != NULL) {
+		surface_sync_locked(driver_data, oldest, 0);
+		if (oldest->request_queued)
+			return -1;
+	}
+
+	rc = v4l2_set_stream(driver_data->video_fd, capture_type, false);
+	if (rc < 0)
+		return -1;
+
+	rc = v4l2_set_stream(driver_data->video_fd, capture_type, true);
+	if (rc < 0)
+		return -1;
+
+	return 0;
+}
+
+VAStatus surface_request_queue(struct request_data *driver_data,
+			       struct object_surface *surface_object)
+{
+	struct video_format *video_format = driver_data->video_format;
+	struct object_context *context_object;
+	struct object_surface *oldest;
+	unsigned int capture_type;
+	unsigned int index;
+	uint64_t cookie;
+	VAStatus status;
+	bool capture_queued = false;
+	bool blocked = false;
+	int rc;
+
+	capture_type = v4l2_type_video_capture(video_format->v4l2_mplane);
+
+	context_object = CONTEXT(driver_data, surface_object->context_id);
+	if (context_object == NULL)
+		return VA_STATUS_ERROR_INVALID_CONTEXT;
+
+	pthread_mutex_lock(&driver_data->mutex);
+
+	/*
+	 * Apply backpressure once the context has as many requests in flight
+	 * as allowed, by waiting for its oldest one, or for the oldest one of
+	 * all when the queue is full. The lock is released while waiting.
+	 * Requests complete in submission order, so this never waits longer
+	 * than needed.
+	 */
+	while (driver_data->queued_count == VIDEO_MAX_FRAME ||
+	       context_object->queued_count >= context_object->queue_depth) {
+		blocked = true;
+
+		oldest = surface_request_oldest(driver_data,
+						driver_data->queued_count == VIDEO_MAX_FRAME ?
+						NULL : context_object);
+		if (oldest == NULL) {
+			/* Only requests of destroyed surfaces are left. */
+			if (driver_data->queued_count == VIDEO_MAX_FRAME)
+				while (driver_data->queued_count > 0)
+					surface_request_pop(driver_data);
+			else
+				context_object->queued_count = 0;
+
+			continue;
+		}
+
+		status = surface_sync_locked(driver_data, oldest, 0);
+		if (status == VA_STATUS_ERROR_OPERATION_FAILED)
+			goto complete;
+	}
+
+	if (blocked) {
+		context_object->stats.blocked_count++;
+		pthread_cond_broadcast(&driver_data->cond);
+	}
+
+	/*
+	 * The capture buffer comes last, right before the request, unless it
+	 * was already queued along with the first slice of the picture.
+	 */
+	if (surface_object->slices_submitted == 0) {
+		surface_buffers_track(driver_data, surface_object);
+
+		rc = v4l2_queue_buffer(driver_data->video_fd, -1, capture_type,
+				       NULL, surface_object->destination_index,
+				       0, surface_object->destination_buffers_count,
+				       0);
+		if (rc < 0) {
+			status = VA_STATUS_ERROR_OPERATION_FAILED;
+			goto complete;
+		}
+
+		capture_queued = true;
+	}
+
+	rc = media_request_queue(surface_object->request_fd);
+	if (rc < 0) {
+		if (capture_queued)
+			surface_capture_reclaim(driver_data);
+
 		status = VA_STATUS_ERROR_OPERATION_FAILED;
-		goto error;
+		goto complete;
 	}
 
-	rc = v4l2_dequeue_buffer(driver_data->video_fd, -1, output_type,
-				 surface_object->source_index, 1);
+	index = (driver_data->queued_index + driver_data->queued_count) %
+		VIDEO_MAX_FRAME;
+
+	driver_data->queued_surfaces_ids[index] = surface_object->base.id;
+	driver_data->queued_count++;
+
+	context_object->queued_count++;
+	context_object->stats.queued_count++;
+
+	if (context_object->queued_count > context_object->stats.queued_max)
+		context_object->stats.queued_max = context_object->queued_count;
+
+	surface_object->request_queued = true;
+	surface_object->request_sequence = ++driver_data->queued_sequence;
+	surface_object->request_time = request_time_us();
+
+	/* Stale completion events are told apart by their sequence. */
+	cookie = (uint64_t)surface_object->request_sequence << 32 |
+		 surface_object->base.id;
+
+	rc = media_waiter_add(driver_data->waiter_fd,
+			      surface_object->request_fd, cookie);
 	if (rc < 0) {
+		/*
+		 * Nothing would ever notice the completion of a request that
+		 * is not watched: complete it right away instead, along with
+		 * the ones queued before it.
+		 */
+		while (surface_object->request_queued &&
+		       driver_data->queued_count > 0)
+			surface_request_retire(driver_data);
+
+		pthread_cond_broadcast(&driver_data->cond);
+
+		if (surface_object->status != VASurfaceDisplaying) {
+			status = VA_STATUS_ERROR_OPERATION_FAILED;
+			goto complete;
+		}
+	}
+
+	status = VA_STATUS_SUCCESS;
+
+complete:
+	pthread_mutex_unlock(&driver_data->mutex);
+
+	return status;
+}
+
+/*
+ * Requests that don't complete a picture are not tracked by the queue: their
+ * OUTPUT buffer and request are reclaimed here before being used again.
+ */
+VAStatus surface_request_reclaim(struct request_data *driver_data,
+				 int request_fd, unsigned int index,
+				 int timeout)
+{
+	VAStatus status;
+	int rc;
+
+	pthread_mutex_lock(&driver_data->mutex);
+
+	rc = media_request_wait_completion(request_fd, timeout);
+	if (rc < 0) {
+		close(request_fd);
 		status = VA_STATUS_ERROR_OPERATION_FAILED;
-		goto error;
+		goto complete;
 	}
 
-	rc = v4l2_dequeue_buffer(driver_data->video_fd, -1, capture_type,
-				 surface_object->destination_index,
-				 surface_object->destination_buffers_count);
+	rc = media_request_reinit(request_fd);
 	if (rc < 0) {
+		close(request_fd);
 		status = VA_STATUS_ERROR_OPERATION_FAILED;
-		goto error;
+		goto complete;
 	}
 
-	surface_object->status = VASurfaceDisplaying;
+	media_request_pool_put(&driver_data->request_pool, request_fd);
+
+	while (index < VIDEO_MAX_FRAME && !driver_data->output_dequeued[index]) {
+		rc = surface_buffer_dequeue(driver_data, true);
+		if (rc < 0) {
+			status = VA_STATUS_ERROR_OPERATION_FAILED;
+			goto complete;
+		}
+	}
 
 	status = VA_STATUS_SUCCESS;
-	goto complete;
 
-error:
-	if (request_fd >= 0) {
-		close(request_fd);
-		surface_object->request_fd = -1;
+complete:
+	pthread_mutex_unlock(&driver_data->mutex);
+
+	return status;
+}
+
+void surface_request_reap(struct request_data *driver_data, uint64_t cookie)
+{
+	struct object_surface *surface_object;
+	unsigned int sequence = cookie >> 32;
+	VASurfaceID surface_id = cookie & 0xffffffff;
+
+	surface_object = SURFACE(driver_data, surface_id);
+	if (surface_object == NULL || !surface_object->request_queued ||
+	    surface_object->request_sequence != sequence)
+		return;
+
+	/* Earlier requests are done too, since they complete in order. */
+	while (surface_object->request_queued && driver_data->queued_count > 0)
+		surface_request_retire(driver_data);
+}
+
+void surface_request_flush(struct request_data *driver_data)
+{
+	struct object_surface *surface_object;
+
+	pthread_mutex_lock(&driver_data->mutex);
+
+	/* Buffers were given back by stream off, only drop the requests. */
+	while (driver_data->queued_count > 0) {
+		surface_object = surface_request_pop(driver_data);
+		if (surface_object == NULL)
+			continue;
+
+		if (surface_object->request_fd >= 0) {
+			media_waiter_remove(driver_data->waiter_fd,
+					    surface_object->request_fd);
+
+			close(surface_object->request_fd);
+			surface_object->request_fd = -1;
+		}
+
+		surface_object->request_queued = false;
+		surface_object->status = VASurfaceReady;
 	}
 
-complete:
+	pthread_cond_broadcast(&driver_data->cond);
+	pthread_mutex_unlock(&driver_data->mutex);
+}
+
+/*
+ * Wait for the surface to be decoded, giving up at the limit time in us (or
+ * never when zero) with VA_STATUS_ERROR_TIMEDOUT. Requests that take longer
+ * than their own timeout are considered failed either way. Called with the
+ * driver mutex held, which is released while waiting.
+ */
+static VAStatus surface_sync_locked(struct request_data *driver_data,
+				    struct object_surface *surface_object,
+				    uint64_t limit)
+{
+	uint64_t cookies[MEDIA_WAITER_EVENTS_MAX];
+	uint64_t time;
+	VAStatus status;
+	bool limited;
+	int timeout;
+	int wait;
+	int count;
+	int rc;
+	int i;
+
+	timeout = surface_request_timeout(driver_data, surface_object);
+
+	if (driver_data->reaper_enabled) {
+		rc = reaper_wait(driver_data, surface_object, timeout, limit);
+		if (rc < 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+	}
+
+	/*
+	 * Wait for any of the queued requests to complete, without holding
+	 * the lock so that other threads can keep queuing pictures. Reaping
+	 * a request also retires the ones queued before it, since requests
+	 * complete in submission order.
+	 */
+	while (!driver_data->reaper_enabled &&
+	       surface_object->status == VASurfaceRendering &&
+	       surface_object->request_queued) {
+		wait = timeout;
+		limited = false;
+
+		if (limit != 0) {
+			time = request_time_us();
+			time = time < limit ? (limit - time + 999) / 1000 : 0;
+
+			if (time <= (uint64_t)wait) {
+				wait = time;
+				limited = true;
+			}
+		}
+
+		pthread_mutex_unlock(&driver_data->mutex);
+
+		count = media_waiter_wait(driver_data->waiter_fd, cookies,
+					  MEDIA_WAITER_EVENTS_MAX, wait);
+
+		pthread_mutex_lock(&driver_data->mutex);
+
+		if (count == 0 && limited)
+			break;
+
+		if (count == 0)
+			request_log("Timeout when waiting for media request\n");
+
+		if (count <= 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+
+		for (i = 0; i < count; i++)
+			surface_request_reap(driver_data, cookies[i]);
+	}
+
+	if (surface_object->status == VASurfaceRendering &&
+	    surface_object->request_queued)
+		status = VA_STATUS_ERROR_TIMEDOUT;
+	else if (surface_object->status == VASurfaceRendering)
+		status = VA_STATUS_ERROR_OPERATION_FAILED;
+	else if (surface_object->destination_error)
+		status = VA_STATUS_ERROR_DECODING_ERROR;
+	else
+		status = VA_STATUS_SUCCESS;
+
 	return status;
 }
 
+static VAStatus surface_sync(struct request_data *driver_data,
+			     struct object_surface *surface_object,
+			     uint64_t limit)
+{
+	VAStatus status;
+
+	pthread_mutex_lock(&driver_data->mutex);
+	status = surface_sync_locked(driver_data, surface_object, limit);
+	pthread_mutex_unlock(&driver_data->mutex);
+
+	return status;
+}
+
+VAStatus surface_request_wait(struct request_data *driver_data,
+			      struct object_surface *surface_object)
+{
+	return surface_sync(driver_data, surface_object, 0);
+}
+
+VAStatus RequestSyncSurface(VADriverContextP context, VASurfaceID surface_id)
+{
+	struct request_data *driver_data = context->pDriverData;
+	struct object_surface *surface_object;
+
+	if (driver_data->video_format == NULL)
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	surface_object = SURFACE(driver_data, surface_id);
+	if (surface_object == NULL)
+		return VA_STATUS_ERROR_INVALID_SURFACE;
+
+	return surface_sync(driver_data, surface_object, 0);
+}
+
+#if VA_CHECK_VERSION(1, 9, 0)
+VAStatus RequestSyncSurface2(VADriverContextP context, VASurfaceID surface_id,
+			     uint64_t timeout_ns)
+{
+	struct request_data *driver_data = context->pDriverData;
+	struct object_surface *surface_object;
+	uint64_t limit = 0;
+	uint64_t now;
+
+	if (driver_data->video_format == NULL)
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	surface_object = SURFACE(driver_data, surface_id);
+	if (surface_object == NULL)
+		return VA_STATUS_ERROR_INVALID_SURFACE;
+
+	/* A zero timeout only picks up the requests that already completed. */
+	if (timeout_ns != VA_TIMEOUT_INFINITE) {
+		now = request_time_us();
+
+		/* Timeouts too large to be represented never expire. */
+		if (timeout_ns / 1000 < UINT64_MAX - now)
+			limit = now + timeout_ns / 1000;
+	}
+
+	return surface_sync(driver_data, surface_object, limit);
+}
+#endif
+
 VAStatus RequestQuerySurfaceAttributes(VADriverContextP context,
 				       VAConfigID config,
 				       VASurfaceAttrib *attributes,
@@ -415,13 +1060,29 @@ VAStatus RequestQuerySurfaceStatus(VADriverContextP context,
 {
 	struct request_data *driver_data = context->pDriverData;
 	struct object_surface *surface_object;
+	uint64_t cookies[MEDIA_WAITER_EVENTS_MAX];
+	int count;
+	int i;
 
 	surface_object = SURFACE(driver_data, surface_id);
 	if (surface_object == NULL)
 		return VA_STATUS_ERROR_INVALID_SURFACE;
 
+	pthread_mutex_lock(&driver_data->mutex);
+
+	/* Without the reaper, pick up completed requests without blocking. */
+	if (!driver_data->reaper_enabled && surface_object->request_queued) {
+		count = media_waiter_wait(driver_data->waiter_fd, cookies,
+					  MEDIA_WAITER_EVENTS_MAX, 0);
+
+		for (i = 0; i < count; i++)
+			surface_request_reap(driver_data, cookies[i]);
+	}
+
 	*status = surface_object->status;
 
+	pthread_mutex_unlock(&driver_data->mutex);
+
 	return VA_STATUS_SUCCESS;
 }
 
@@ -480,6 +1141,12 @@ VAStatus RequestExportSurfaceHandle(VADriverContextP context,
 	if (surface_object == NULL)
 		return VA_STATUS_ERROR_INVALID_SURFACE;
 
+	if (surface_object->status == VASurfaceRendering) {
+		status = RequestSyncSurface(context, surface_id);
+		if (status != VA_STATUS_SUCCESS)
+			return status;
+	}
+
 	export_fds_count = surface_object->destination_buffers_count;
 	export_fds = malloc(export_fds_count * sizeof(*export_fds));
 
@@ -33,6 +33,8 @@
 
 #include "object_heap.h"
 
+struct request_data;
+
 #define SURFACE(data, id)                                                      \
 	((struct object_surface *)object_heap_lookup(&(data)->surface_heap, id))
 #define SURFACE_ID_OFFSET		0x04000000
@@ -44,9 +46,12 @@ struct object_surface {
 	int width;
 	int height;
 
+	/* Context source buffer bound to the picture, -1 when unbound. */
+	int source_buffer;
 	unsigned int source_index;
 	void *source_data;
 	unsigned int source_size;
+	bool source_dequeued;
 
 	unsigned int destination_index;
 	void *destination_map[VIDEO_MAX_PLANES];
@@ -58,33 +63,53 @@ struct object_surface {
 	unsigned int destination_bytesperlines[VIDEO_MAX_PLANES];
 	unsigned int destination_planes_count;
 	unsigned int destination_buffers_count;
+	bool destination_dequeued;
+	bool destination_error;
 
 	unsigned int slices_size;
 	unsigned int slices_count;
+	/* Slices whose data was stored, when their data gets rewritten. */
+	unsigned int slices_data_count;
+	unsigned int slices_submitted;
+
+	/* Codec slice parameters of the picture, grown as needed. */
+	void *slices_params;
+	unsigned int slices_params_size;
+
+	/* Context slice buffer holding the slice data, when not copied. */
+	int slices_buffer;
+
+	/* OUTPUT buffer carrying the request that completes the picture. */
+	unsigned int output_index;
 
 	struct timeval timestamp;
 
 	union {
 		struct {
 			VAPictureParameterBufferMPEG2 picture;
-			VASliceParameterBufferMPEG2 slice;
 			VAIQMatrixBufferMPEG2 iqmatrix;
 			bool iqmatrix_set;
 		} mpeg2;
 		struct {
 			VAIQMatrixBufferH264 matrix;
 			VAPictureParameterBufferH264 picture;
-			VASliceParameterBufferH264 slice;
 		} h264;
 		struct {
 			VAPictureParameterBufferHEVC picture;
-			VASliceParameterBufferHEVC slice;
 			VAIQMatrixBufferHEVC iqmatrix;
 			bool iqmatrix_set;
 		} h265;
 	} params;
 
+	/* Only valid while the request is being built or queued. */
 	int request_fd;
+	bool request_queued;
+	unsigned int request_sequence;
+	uint64_t request_time;
+	VAContextID context_id;
+
+	/* Contexts holding the surface as a reference picture. */
+	unsigned int refs_count;
 };
 
 VAStatus RequestCreateSurfaces2(VADriverContextP context, unsigned int format,
@@ -99,6 +124,29 @@ VAStatus RequestCreateSurfaces(VADriverContextP context, int width, int height,
 VAStatus RequestDestroySurfaces(VADriverContextP context,
 				VASurfaceID *surfaces_ids, int surfaces_count);
 VAStatus RequestSyncSurface(VADriverContextP context, VASurfaceID surface_id);
+#if VA_CHECK_VERSION(1, 9, 0)
+VAStatus RequestSyncSurface2(VADriverContextP context, VASurfaceID surface_id,
+			     uint64_t timeout_ns);
+#endif
+void *surface_slice_params(struct object_surface *surface_object,
+			   unsigned int index, unsigned int size);
+void surface_buffers_track(struct request_data *driver_data,
+			   struct object_surface *surface_object);
+void surface_output_track(struct request_data *driver_data, unsigned int index,
+			  VASurfaceID surface_id);
+VAStatus surface_request_acquire(struct request_data *driver_data,
+				 struct object_surface *surface_object);
+void surface_request_release(struct request_data *driver_data,
+			     struct object_surface *surface_object);
+VAStatus surface_request_queue(struct request_data *driver_data,
+			       struct object_surface *surface_object);
+VAStatus surface_request_reclaim(struct request_data *driver_data,
+				 int request_fd, unsigned int index,
+				 int timeout);
+VAStatus surface_request_wait(struct request_data *driver_data,
+			      struct object_surface *surface_object);
+void surface_request_flush(struct request_data *driver_data);
+void surface_request_reap(struct request_data *driver_data, uint64_t cookie);
 VAStatus RequestQuerySurfaceAttributes(VADriverContextP context,
 				       VAConfigID config,
 				       VASurfaceAttrib *attributes,
@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2014 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Portable versions of the tiled format conversions, along with SIMD ones
+ * selected when the library is loaded, depending on the CPU features.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "tiled_yuv.h"
+
+#define TILE_WIDTH	32
+#define TILE_HEIGHT	32
+#define TILE_SIZE	(TILE_WIDTH * TILE_HEIGHT)
+
+#if defined(__arm__) || defined(__aarch64__)
+/* Implemented in tiled_yuv.S. */
+void tiled_to_planar_neon(void *src, void *dst, unsigned int dst_pitch,
+			  unsigned int width, unsigned int height);
+void tiled_deinterleave_to_planar_neon(void *src, void *dst1, void *dst2,
+				       unsigned int dst_pitch,
+				       unsigned int width, unsigned int height);
+#endif
+
+/* Start of line y in the tiled source, whose tiles are stored row by row. */
+static inline uint8_t *tiled_line(void *src, unsigned int width, unsigned int y)
+{
+	unsigned int tiles = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+
+	return (uint8_t *)src + (y / TILE_HEIGHT) * tiles * TILE_SIZE +
+	       (y % TILE_HEIGHT) * TILE_WIDTH;
+}
+
+static void tiled_to_planar_c(void *src, void *dst, unsigned int dst_pitch,
+			      unsigned int width, unsigned int height)
+{
+	uint8_t *line_src, *line_dst;
+	unsigned int x, y;
+	unsigned int size;
+
+	for (y = 0; y < height; y++) {
+		line_src = tiled_line(src, width, y);
+		line_dst = (uint8_t *)dst + y * dst_pitch;
+
+		for (x = 0; x < width; x += TILE_WIDTH) {
+			size = width - x < TILE_WIDTH ? width - x : TILE_WIDTH;
+			memcpy(line_dst + x, line_src, size);
+			line_src += TILE_SIZE;
+		}
+	}
+}
+
+/* Only the tiles overlapping the rectangle are read. */
+void tiled_to_planar_rect(void *src, unsigned int src_width, void *dst,
+			  unsigned int dst_pitch, unsigned int x,
+			  unsigned int y, unsigned int width,
+			  unsigned int height)
+{
+	uint8_t *line_src, *line_dst;
+	unsigned int offset, size;
+	unsigned int i, j;
+
+	for (j = 0; j < height; j++) {
+		line_src = tiled_line(src, src_width, y + j);
+		line_dst = (uint8_t *)dst + j * dst_pitch;
+
+		for (i = 0; i < width; i += size) {
+			offset = (x + i) % TILE_WIDTH;
+			size = TILE_WIDTH - offset;
+			if (size > width - i)
+				size = width - i;
+
+			memcpy(line_dst + i,
+			       line_src + ((x + i) / TILE_WIDTH) * TILE_SIZE +
+			       offset, size);
+		}
+	}
+}
+
+/* The width is the one of the interleaved plane, an odd byte is dropped. */
+static void tiled_deinterleave_line(uint8_t *line_src, uint8_t *line_dst1,
+				    uint8_t *line_dst2, unsigned int x,
+				    unsigned int width)
+{
+	unsigned int i;
+
+	for (; x < width / 2; x++) {
+		i = (x / (TILE_WIDTH / 2)) * TILE_SIZE +
+		    (x % (TILE_WIDTH / 2)) * 2;
+
+		line_dst1[x] = line_src[i];
+		line_dst2[x] = line_src[i + 1];
+	}
+}
+
+static void tiled_deinterleave_to_planar_c(void *src, void *dst1, void *dst2,
+					   unsigned int dst_pitch,
+					   unsigned int width,
+					   unsigned int height)
+{
+	unsigned int y;
+
+	for (y = 0; y < height; y++)
+		tiled_deinterleave_line(tiled_line(src, width, y),
+					(uint8_t *)dst1 + y * dst_pitch,
+					(uint8_t *)dst2 + y * dst_pitch, 0,
+					width);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2")))
+static void tiled_to_planar_sse2(void *src, void *dst, unsigned int dst_pitch,
+				 unsigned int width, unsigned int height)
+{
+	unsigned int tiles = width / TILE_WIDTH;
+	uint8_t *line_src, *line_dst;
+	__m128i a, b;
+	unsigned int x, y;
+
+	for (y = 0; y < height; y++) {
+		line_src = tiled_line(src, width, y);
+		line_dst = (uint8_t *)dst + y * dst_pitch;
+
+		for (x = 0; x < tiles; x++) {
+			a = _mm_loadu_si128((__m128i *)line_src);
+			b = _mm_loadu_si128((__m128i *)(line_src + 16));
+			_mm_storeu_si128((__m128i *)line_dst, a);
+			_mm_storeu_si128((__m128i *)(line_dst + 16), b);
+
+			line_src += TILE_SIZE;
+			line_dst += TILE_WIDTH;
+		}
+
+		if (width % TILE_WIDTH)
+			memcpy(line_dst, line_src, width % TILE_WIDTH);
+	}
+}
+
+__attribute__((target("sse2")))
+static void tiled_deinterleave_to_planar_sse2(void *src, void *dst1,
+					      void *dst2,
+					      unsigned int dst_pitch,
+					      unsigned int width,
+					      unsigned int height)
+{
+	unsigned int tiles = width / TILE_WIDTH;
+	__m128i mask = _mm_set1_epi16(0x00ff);
+	uint8_t *line_src, *line_dst1, *line_dst2;
+	__m128i a, b;
+	unsigned int x, y;
+
+	for (y = 0; y < height; y++) {
+		line_src = tiled_line(src, width, y);
+		line_dst1 = (uint8_t *)dst1 + y * dst_pitch;
+		line_dst2 = (uint8_t *)dst2 + y * dst_pitch;
+
+		for (x = 0; x < tiles; x++) {
+			a = _mm_loadu_si128((__m128i *)(line_src + x * TILE_SIZE));
+			b = _mm_loadu_si128((__m128i *)(line_src + x * TILE_SIZE +
+						       16));
+
+			_mm_storeu_si128((__m128i *)(line_dst1 + x * 16),
+					 _mm_packus_epi16(_mm_and_si128(a, mask),
+							  _mm_and_si128(b, mask)));
+			_mm_storeu_si128((__m128i *)(line_dst2 + x * 16),
+					 _mm_packus_epi16(_mm_srli_epi16(a, 8),
+							  _mm_srli_epi16(b, 8)));
+		}
+
+		tiled_deinterleave_line(line_src, line_dst1, line_dst2,
+					tiles * TILE_WIDTH / 2, width);
+	}
+}
+
+__attribute__((target("avx2")))
+static void tiled_to_planar_avx2(void *src, void *dst, unsigned int dst_pitch,
+				 unsigned int width, unsigned int height)
+{
+	unsigned int tiles = width / TILE_WIDTH;
+	uint8_t *line_src, *line_dst;
+	unsigned int x, y;
+
+	for (y = 0; y < height; y++) {
+		line_src = tiled_line(src, width, y);
+		line_dst = (uint8_t *)dst + y * dst_pitch;
+
+		for (x = 0; x < tiles; x++) {
+			_mm256_storeu_si256((__m256i *)line_dst,
+					    _mm256_loadu_si256((__m256i *)line_src));
+
+			line_src += TILE_SIZE;
+			line_dst += TILE_WIDTH;
+		}
+
+		if (width % TILE_WIDTH)
+			memcpy(line_dst, line_src, width % TILE_WIDTH);
+	}
+}
+
+__attribute__((target("avx2")))
+static void tiled_deinterleave_to_planar_avx2(void *src, void *dst1,
+					      void *dst2,
+					      unsigned int dst_pitch,
+					      unsigned int width,
+					      unsigned int height)
+{
+	unsigned int tiles = width / TILE_WIDTH;
+	__m256i mask = _mm256_set1_epi16(0x00ff);
+	uint8_t *line_src, *line_dst1, *line_dst2;
+	__m256i a, u, v;
+	unsigned int x, y;
+
+	for (y = 0; y < height; y++) {
+		line_src = tiled_line(src, width, y);
+		line_dst1 = (uint8_t *)dst1 + y * dst_pitch;
+		line_dst2 = (uint8_t *)dst2 + y * dst_pitch;
+
+		for (x = 0; x < tiles; x++) {
+			a = _mm256_loadu_si256((__m256i *)(line_src +
+							  x * TILE_SIZE));
+
+			/* Packing works per 128-bit lane, gather the halves. */
+			u = _mm256_packus_epi16(_mm256_and_si256(a, mask),
+						_mm256_setzero_si256());
+			v = _mm256_packus_epi16(_mm256_srli_epi16(a, 8),
+						_mm256_setzero_si256());
+			u = _mm256_permute4x64_epi64(u, 0xd8);
+			v = _mm256_permute4x64_epi64(v, 0xd8);
+
+			_mm_storeu_si128((__m128i *)(line_dst1 + x * 16),
+					 _mm256_castsi256_si128(u));
+			_mm_storeu_si128((__m128i *)(line_dst2 + x * 16),
+					 _mm256_castsi256_si128(v));
+		}
+
+		tiled_deinterleave_line(line_src, line_dst1, line_dst2,
+					tiles * TILE_WIDTH / 2, width);
+	}
+}
+
+#endif
+
+static bool tiled_yuv_supported_always(void)
+{
+	return true;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static bool tiled_yuv_supported_sse2(void)
+{
+	__builtin_cpu_init();
+
+	return __builtin_cpu_supports("sse2");
+}
+
+static bool tiled_yuv_supported_avx2(void)
+{
+	__builtin_cpu_init();
+
+	return __builtin_cpu_supports("avx2");
+}
+#elif defined(__arm__)
+static bool tiled_yuv_supported_neon(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+}
+#endif
+
+const struct tiled_yuv_impl tiled_yuv_impls[] = {
+#if defined(__x86_64__) || defined(__i386__)
+	{
+		.name = "avx2",
+		.supported = tiled_yuv_supported_avx2,
+		.to_planar = tiled_to_planar_avx2,
+		.deinterleave_to_planar = tiled_deinterleave_to_planar_avx2,
+	},
+	{
+		.name = "sse2",
+		.supported = tiled_yuv_supported_sse2,
+		.to_planar = tiled_to_planar_sse2,
+		.deinterleave_to_planar = tiled_deinterleave_to_planar_sse2,
+	},
+#elif defined(__arm__) || defined(__aarch64__)
+	{
+		.name = "neon",
+#if defined(__arm__)
+		.supported = tiled_yuv_supported_neon,
+#else
+		.supported = tiled_yuv_supported_always,
+#endif
+		.to_planar = tiled_to_planar_neon,
+		.deinterleave_to_planar = tiled_deinterleave_to_planar_neon,
+	},
+#endif
+	{
+		.name = "c",
+		.supported = tiled_yuv_supported_always,
+		.to_planar = tiled_to_planar_c,
+		.deinterleave_to_planar = tiled_deinterleave_to_planar_c,
+	},
+	{ 0 }
+};
+
+static const struct tiled_yuv_impl *tiled_yuv_impl;
+
+__attribute__((constructor))
+static void tiled_yuv_select(void)
+{
+	const struct tiled_yuv_impl *impl;
+
+	for (impl = tiled_yuv_impls; impl->name != NULL; impl++)
+		if (impl->supported())
+			break;
+
+	tiled_yuv_impl = impl;
+}
+
+void tiled_to_planar(void *src, void *dst, unsigned int dst_pitch,
+		     unsigned int width, unsigned int height)
+{
+	tiled_yuv_impl->to_planar(src, dst, dst_pitch, width, height);
+}
+
+void tiled_deinterleave_to_planar(void *src, void *dst1, void *dst2,
+				  unsigned int dst_pitch, unsigned int width,
+				  unsigned int height)
+{
+	tiled_yuv_impl->deinterleave_to_planar(src, dst1, dst2, dst_pitch,
+					       width, height);
+}
@@ -20,6 +20,24 @@
 #ifndef _TILED_YUV_H_
 #define _TILED_YUV_H_
 
+#include <stdbool.h>
+
+/* Conversion variant, the table is sorted by preference. */
+struct tiled_yuv_impl {
+	const char *name;
+	bool (*supported)(void);
+
+	void (*to_planar)(void *src, void *dst, unsigned int dst_pitch,
+			  unsigned int width, unsigned int height);
+	void (*deinterleave_to_planar)(void *src, void *dst1, void *dst2,
+				       unsigned int dst_pitch,
+				       unsigned int width,
+				       unsigned int height);
+};
+
+/* Terminated by an entry without name, the portable variant comes last. */
+extern const struct tiled_yuv_impl tiled_yuv_impls[];
+
 void tiled_to_planar(void *src, void *dst, unsigned int dst_pitch,
 		     unsigned int width, unsigned int height);
 
@@ -27,4 +45,9 @@ void tiled_deinterleave_to_planar(void *src, void *dst1, void *dst2,
 				  unsigned int dst_pitch, unsigned int width,
 				  unsigned int height);
 
+void tiled_to_planar_rect(void *src, unsigned int src_width, void *dst,
+			  unsigned int dst_pitch, unsigned int x,
+			  unsigned int y, unsigned int width,
+			  unsigned int height);
+
 #endif
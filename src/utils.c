@@ -26,6 +26,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "request.h"
 #include "utils.h"
@@ -40,3 +41,12 @@ void request_log(const char *format, ...)
 	vfprintf(stderr, format, arguments);
 	va_end(arguments);
 }
+
+uint64_t request_time_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
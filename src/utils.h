@@ -26,6 +26,9 @@
 #ifndef _UTILS_H_
 #define _UTILS_H_
 
+#include <stdint.h>
+
 void request_log(const char *format, ...);
+uint64_t request_time_us(void);
 
 #endif
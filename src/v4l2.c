@@ -91,15 +91,11 @@ int v4l2_query_capabilities(int video_fd, unsigned int *capabilities)
 
 static void v4l2_setup_format(struct v4l2_format *format, unsigned int type,
 			      unsigned int width, unsigned int height,
-			      unsigned int pixelformat)
+			      unsigned int pixelformat, unsigned int sizeimage)
 {
-	unsigned int sizeimage;
-
 	memset(format, 0, sizeof(*format));
 	format->type = type;
 
-	sizeimage = v4l2_type_is_output(type) ? SOURCE_SIZE_MAX : 0;
-
 	if (v4l2_type_is_mplane(type)) {
 		format->fmt.pix_mp.width = width;
 		format->fmt.pix_mp.height = height;
@@ -142,7 +138,8 @@ int v4l2_try_format(int video_fd, unsigned int type, unsigned int width,
 	struct v4l2_format format;
 	int rc;
 
-	v4l2_setup_format(&format, type, width, height, pixelformat);
+	v4l2_setup_format(&format, type, width, height, pixelformat,
+			  v4l2_type_is_output(type) ? SOURCE_SIZE_MIN : 0);
 
 	rc = ioctl(video_fd, VIDIOC_TRY_FMT, &format);
 	if (rc < 0) {
@@ -155,12 +152,13 @@ int v4l2_try_format(int video_fd, unsigned int type, unsigned int width,
 }
 
 int v4l2_set_format(int video_fd, unsigned int type, unsigned int pixelformat,
-		    unsigned int width, unsigned int height)
+		    unsigned int width, unsigned int height,
+		    unsigned int sizeimage)
 {
 	struct v4l2_format format;
 	int rc;
 
-	v4l2_setup_format(&format, type, width, height, pixelformat);
+	v4l2_setup_format(&format, type, width, height, pixelformat, sizeimage);
 
 	rc = ioctl(video_fd, VIDIOC_S_FMT, &format);
 	if (rc < 0) {
@@ -235,15 +233,16 @@ int v4l2_get_format(int video_fd, unsigned int type, unsigned int *width,
 	return 0;
 }
 
-int v4l2_create_buffers(int video_fd, unsigned int type,
-			unsigned int buffers_count, unsigned int *index_base)
+int v4l2_create_buffers(int video_fd, unsigned int type, unsigned int memory,
+			unsigned int buffers_count, unsigned int sizeimage,
+			unsigned int *index_base)
 {
 	struct v4l2_create_buffers buffers;
 	int rc;
 
 	memset(&buffers, 0, sizeof(buffers));
 	buffers.format.type = type;
-	buffers.memory = V4L2_MEMORY_MMAP;
+	buffers.memory = memory;
 	buffers.count = buffers_count;
 
 	rc = ioctl(video_fd, VIDIOC_G_FMT, &buffers.format);
@@ -253,6 +252,15 @@ int v4l2_create_buffers(int video_fd, unsigned int type,
 		return -1;
 	}
 
+	/* Buffers may be larger than what the current format requires. */
+	if (sizeimage > 0) {
+		if (v4l2_type_is_mplane(type))
+			buffers.format.fmt.pix_mp.plane_fmt[0].sizeimage =
+				sizeimage;
+		else
+			buffers.format.fmt.pix.sizeimage = sizeimage;
+	}
+
 	rc = ioctl(video_fd, VIDIOC_CREATE_BUFS, &buffers);
 	if (rc < 0) {
 		request_log("Unable to create buffer for type %d: %s\n", type,
@@ -266,6 +274,37 @@ int v4l2_create_buffers(int video_fd, unsigned int type,
 	return 0;
 }
 
+int v4l2_query_buffers_capabilities(int video_fd, unsigned int type,
+				    unsigned int *capabilities)
+{
+	struct v4l2_create_buffers buffers;
+	int rc;
+
+	memset(&buffers, 0, sizeof(buffers));
+	buffers.format.type = type;
+	buffers.memory = V4L2_MEMORY_MMAP;
+	buffers.count = 0;
+
+	rc = ioctl(video_fd, VIDIOC_G_FMT, &buffers.format);
+	if (rc < 0) {
+		request_log("Unable to get format for type %d: %s\n", type,
+			    strerror(errno));
+		return -1;
+	}
+
+	/* Creating no buffer only reports the queue capabilities. */
+	rc = ioctl(video_fd, VIDIOC_CREATE_BUFS, &buffers);
+	if (rc < 0) {
+		request_log("Unable to query buffers for type %d: %s\n", type,
+			    strerror(errno));
+		return -1;
+	}
+
+	*capabilities = buffers.capabilities;
+
+	return 0;
+}
+
 int v4l2_query_buffer(int video_fd, unsigned int type, unsigned int index,
 		      unsigned int *lengths, unsigned int *offsets,
 		      unsigned int buffers_count)
@@ -309,7 +348,7 @@ int v4l2_query_buffer(int video_fd, unsigned int type, unsigned int index,
 	return 0;
 }
 
-int v4l2_request_buffers(int video_fd, unsigned int type,
+int v4l2_request_buffers(int video_fd, unsigned int type, unsigned int memory,
 			 unsigned int buffers_count)
 {
 	struct v4l2_requestbuffers buffers;
@@ -317,7 +356,7 @@ int v4l2_request_buffers(int video_fd, unsigned int type,
 
 	memset(&buffers, 0, sizeof(buffers));
 	buffers.type = type;
-	buffers.memory = V4L2_MEMORY_MMAP;
+	buffers.memory = memory;
 	buffers.count = buffers_count;
 
 	rc = ioctl(video_fd, VIDIOC_REQBUFS, &buffers);
@@ -331,7 +370,8 @@ int v4l2_request_buffers(int video_fd, unsigned int type,
 
 int v4l2_queue_buffer(int video_fd, int request_fd, unsigned int type,
 		      struct timeval *timestamp, unsigned int index,
-		      unsigned int size, unsigned int buffers_count)
+		      unsigned int size, unsigned int buffers_count,
+		      unsigned int flags)
 {
 	struct v4l2_plane planes[buffers_count];
 	struct v4l2_buffer buffer;
@@ -353,8 +393,10 @@ int v4l2_queue_buffer(int video_fd, int request_fd, unsigned int type,
 		else
 			buffer.bytesused = size;
 
+	buffer.flags = flags;
+
 	if (request_fd >= 0) {
-		buffer.flags = V4L2_BUF_FLAG_REQUEST_FD;
+		buffer.flags |= V4L2_BUF_FLAG_REQUEST_FD;
 		buffer.request_fd = request_fd;
 	}
 
@@ -370,8 +412,55 @@ int v4l2_queue_buffer(int video_fd, int request_fd, unsigned int type,
 	return 0;
 }
 
+/* Queues a single-planar buffer imported from a dmabuf. */
+int v4l2_queue_dmabuf(int video_fd, int request_fd, unsigned int type,
+		      struct timeval *timestamp, unsigned int index, int fd,
+		      unsigned int size, unsigned int flags)
+{
+	struct v4l2_plane plane;
+	struct v4l2_buffer buffer;
+	int rc;
+
+	memset(&plane, 0, sizeof(plane));
+	memset(&buffer, 0, sizeof(buffer));
+
+	buffer.type = type;
+	buffer.memory = V4L2_MEMORY_DMABUF;
+	buffer.index = index;
+
+	if (v4l2_type_is_mplane(type)) {
+		plane.m.fd = fd;
+		plane.bytesused = size;
+
+		buffer.length = 1;
+		buffer.m.planes = &plane;
+	} else {
+		buffer.m.fd = fd;
+		buffer.bytesused = size;
+	}
+
+	buffer.flags = flags;
+
+	if (request_fd >= 0) {
+		buffer.flags |= V4L2_BUF_FLAG_REQUEST_FD;
+		buffer.request_fd = request_fd;
+	}
+
+	if (timestamp != NULL)
+		buffer.timestamp = *timestamp;
+
+	rc = ioctl(video_fd, VIDIOC_QBUF, &buffer);
+	if (rc < 0) {
+		request_log("Unable to queue dmabuf: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
 int v4l2_dequeue_buffer(int video_fd, int request_fd, unsigned int type,
-			unsigned int index, unsigned int buffers_count)
+			unsigned int memory, unsigned int buffers_count,
+			unsigned int *index, unsigned int *flags)
 {
 	struct v4l2_plane planes[buffers_count];
 	struct v4l2_buffer buffer;
@@ -381,8 +470,7 @@ int v4l2_dequeue_buffer(int video_fd, int request_fd, unsigned int type,
 	memset(&buffer, 0, sizeof(buffer));
 
 	buffer.type = type;
-	buffer.memory = V4L2_MEMORY_MMAP;
-	buffer.index = index;
+	buffer.memory = memory;
 	buffer.length = buffers_count;
 	buffer.m.planes = planes;
 
@@ -397,6 +485,13 @@ int v4l2_dequeue_buffer(int video_fd, int request_fd, unsigned int type,
 		return -1;
 	}
 
+	/* The kernel hands out whichever buffer is done first. */
+	if (index != NULL)
+		*index = buffer.index;
+
+	if (flags != NULL)
+		*flags = buffer.flags;
+
 	return 0;
 }
 
@@ -432,24 +527,110 @@ int v4l2_set_control(int video_fd, int request_fd, unsigned int id, void *data,
 		     unsigned int size)
 {
 	struct v4l2_ext_control control;
-	struct v4l2_ext_controls controls;
-	int rc;
 
 	memset(&control, 0, sizeof(control));
-	memset(&controls, 0, sizeof(controls));
 
 	control.id = id;
 	control.ptr = data;
 	control.size = size;
 
-	controls.controls = &control;
-	controls.count = 1;
+	return v4l2_set_controls(video_fd, request_fd, &control, 1);
+}
+
+/*
+ * All the controls are set with a single ioctl. The kernel reports the first
+ * failing control, or the controls count when the failure can't be narrowed.
+ */
+int v4l2_set_controls(int video_fd, int request_fd,
+		      struct v4l2_ext_control *control_array,
+		      unsigned int count)
+{
+	struct v4l2_ext_controls controls;
+	int rc;
+
+	memset(&controls, 0, sizeof(controls));
+
+	controls.controls = control_array;
+	controls.count = count;
 
 	if (request_fd >= 0) {
 		controls.which = V4L2_CTRL_WHICH_REQUEST_VAL;
 		controls.request_fd = request_fd;
 	}
 
+	rc = ioctl(video_fd, VIDIOC_S_EXT_CTRLS, &controls);
+	if (rc < 0) {
+		if (controls.error_idx < count)
+			request_log("Unable to set control %#x: %s\n",
+				    control_array[controls.error_idx].id,
+				    strerror(errno));
+		else
+			request_log("Unable to set %u controls: %s\n", count,
+				    strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Unknown controls are expected, and not reported as errors. */
+int v4l2_query_control(int video_fd, unsigned int id,
+		       struct v4l2_query_ext_ctrl *control)
+{
+	int rc;
+
+	memset(control, 0, sizeof(*control));
+	control->id = id;
+
+	rc = ioctl(video_fd, VIDIOC_QUERY_EXT_CTRL, control);
+	if (rc < 0)
+		return -1;
+
+	return 0;
+}
+
+int v4l2_query_control_menu(int video_fd, unsigned int id,
+			    long long minimum, long long maximum,
+			    unsigned int *values_mask)
+{
+	struct v4l2_querymenu menu;
+	long long i;
+	int rc;
+
+	*values_mask = 0;
+
+	/* Menu indexes outside of the mask width cannot be reported. */
+	if (minimum < 0)
+		minimum = 0;
+
+	for (i = minimum; i <= maximum && i < 32; i++) {
+		memset(&menu, 0, sizeof(menu));
+		menu.id = id;
+		menu.index = i;
+
+		rc = ioctl(video_fd, VIDIOC_QUERYMENU, &menu);
+		if (rc == 0)
+			*values_mask |= 1U << i;
+	}
+
+	return 0;
+}
+
+int v4l2_set_control_value(int video_fd, unsigned int id, int value)
+{
+	struct v4l2_ext_control control;
+	struct v4l2_ext_controls controls;
+	int rc;
+
+	memset(&control, 0, sizeof(control));
+	memset(&controls, 0, sizeof(controls));
+
+	control.id = id;
+	control.value = value;
+
+	controls.controls = &control;
+	controls.count = 1;
+
 	rc = ioctl(video_fd, VIDIOC_S_EXT_CTRLS, &controls);
 	if (rc < 0) {
 		request_log("Unable to set control: %s\n", strerror(errno));
@@ -459,6 +640,23 @@ int v4l2_set_control(int video_fd, int request_fd, unsigned int id, void *data,
 	return 0;
 }
 
+int v4l2_flush_decoder(int video_fd)
+{
+	struct v4l2_decoder_cmd command;
+	int rc;
+
+	memset(&command, 0, sizeof(command));
+	command.cmd = V4L2_DEC_CMD_FLUSH;
+
+	rc = ioctl(video_fd, VIDIOC_DECODER_CMD, &command);
+	if (rc < 0) {
+		request_log("Unable to flush decoder: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
 int v4l2_set_stream(int video_fd, unsigned int type, bool enable)
 {
 	enum v4l2_buf_type buf_type = type;
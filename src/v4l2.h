@@ -27,7 +27,19 @@
 
 #include <stdbool.h>
 
-#define SOURCE_SIZE_MAX						(1024 * 1024)
+#include <linux/videodev2.h>
+
+#define SOURCE_SIZE_MIN						(256 * 1024)
+#define SOURCE_SIZE_ALIGN					(4 * 1024)
+
+/* Introduced with Linux 5.7, older kernels simply don't report it. */
+#ifndef V4L2_BUF_CAP_SUPPORTS_M2M_HOLD_CAPTURE_BUF
+#define V4L2_BUF_CAP_SUPPORTS_M2M_HOLD_CAPTURE_BUF		(1 << 5)
+#endif
+
+#ifndef V4L2_BUF_FLAG_M2M_HOLD_CAPTURE_BUF
+#define V4L2_BUF_FLAG_M2M_HOLD_CAPTURE_BUF			0x00000200
+#endif
 
 unsigned int v4l2_type_video_output(bool mplane);
 unsigned int v4l2_type_video_capture(bool mplane);
@@ -35,27 +47,46 @@ int v4l2_query_capabilities(int video_fd, unsigned int *capabilities);
 bool v4l2_find_format(int video_fd, unsigned int type,
 		      unsigned int pixelformat);
 int v4l2_set_format(int video_fd, unsigned int type, unsigned int pixelformat,
-		    unsigned int width, unsigned int height);
+		    unsigned int width, unsigned int height,
+		    unsigned int sizeimage);
 int v4l2_get_format(int video_fd, unsigned int type, unsigned int *width,
 		    unsigned int *height, unsigned int *bytesperline,
 		    unsigned int *sizes, unsigned int *planes_count);
-int v4l2_create_buffers(int video_fd, unsigned int type,
-			unsigned int buffers_count, unsigned int *index_base);
+int v4l2_create_buffers(int video_fd, unsigned int type, unsigned int memory,
+			unsigned int buffers_count, unsigned int sizeimage,
+			unsigned int *index_base);
+int v4l2_query_buffers_capabilities(int video_fd, unsigned int type,
+				    unsigned int *capabilities);
 int v4l2_query_buffer(int video_fd, unsigned int type, unsigned int index,
 		      unsigned int *lengths, unsigned int *offsets,
 		      unsigned int buffers_count);
-int v4l2_request_buffers(int video_fd, unsigned int type,
+int v4l2_request_buffers(int video_fd, unsigned int type, unsigned int memory,
 			 unsigned int buffers_count);
 int v4l2_queue_buffer(int video_fd, int request_fd, unsigned int type,
 		      struct timeval *timestamp, unsigned int index,
-		      unsigned int size, unsigned int buffers_count);
+		      unsigned int size, unsigned int buffers_count,
+		      unsigned int flags);
+int v4l2_queue_dmabuf(int video_fd, int request_fd, unsigned int type,
+		      struct timeval *timestamp, unsigned int index, int fd,
+		      unsigned int size, unsigned int flags);
 int v4l2_dequeue_buffer(int video_fd, int request_fd, unsigned int type,
-			unsigned int index, unsigned int buffers_count);
+			unsigned int memory, unsigned int buffers_count,
+			unsigned int *index, unsigned int *flags);
 int v4l2_export_buffer(int video_fd, unsigned int type, unsigned int index,
 		       unsigned int flags, int *export_fds,
 		       unsigned int export_fds_count);
 int v4l2_set_control(int video_fd, int request_fd, unsigned int id, void *data,
 		     unsigned int size);
+int v4l2_set_controls(int video_fd, int request_fd,
+		      struct v4l2_ext_control *control_array,
+		      unsigned int count);
+int v4l2_query_control(int video_fd, unsigned int id,
+		       struct v4l2_query_ext_ctrl *control);
+int v4l2_query_control_menu(int video_fd, unsigned int id,
+			    long long minimum, long long maximum,
+			    unsigned int *values_mask);
+int v4l2_set_control_value(int video_fd, unsigned int id, int value);
+int v4l2_flush_decoder(int video_fd);
 int v4l2_set_stream(int video_fd, unsigned int type, bool enable);
 
 #endif
@@ -0,0 +1,389 @@
+/*
+ * Copyright (C) 2019 Bootlin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Drives RequestEndPicture against a mocked ioctl(), to check how it recovers
+ * from the driver rejecting the MPEG-2 quantization matrices, the OUTPUT
+ * buffer or the request itself.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/media.h>
+#include <linux/videodev2.h>
+
+#include <mpeg2-ctrls.h>
+
+#include "config.h"
+#include "context.h"
+#include "media.h"
+#include "picture.h"
+#include "ref.h"
+#include "request.h"
+#include "surface.h"
+#include "video.h"
+
+static struct {
+	/* Control rejected by VIDIOC_S_EXT_CTRLS, zero to accept all. */
+	unsigned int reject_control_id;
+	bool reject_output_queue;
+	bool reject_request_queue;
+
+	unsigned int set_controls_count;
+	unsigned int set_controls_last_count;
+	unsigned int slice_bit_size;
+	unsigned int output_queued_count;
+	unsigned int capture_queued_count;
+	unsigned int capture_streamoff_count;
+} mock;
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	struct v4l2_ext_controls *controls;
+	struct v4l2_buffer *buffer;
+	unsigned int i;
+	va_list args;
+	void *arg;
+
+	va_start(args, request);
+	arg = va_arg(args, void *);
+	va_end(args);
+
+	switch (request) {
+	case VIDIOC_S_EXT_CTRLS:
+		controls = arg;
+
+		mock.set_controls_count++;
+		mock.set_controls_last_count = controls->count;
+
+		for (i = 0; i < controls->count; i++) {
+			if (controls->controls[i].id ==
+			    V4L2_CID_MPEG_VIDEO_MPEG2_SLICE_PARAMS)
+				mock.slice_bit_size =
+					((struct v4l2_ctrl_mpeg2_slice_params *)
+					 controls->controls[i].ptr)->bit_size;
+
+			if (controls->controls[i].id ==
+			    mock.reject_control_id) {
+				controls->error_idx = i;
+				errno = EINVAL;
+				return -1;
+			}
+		}
+
+		return 0;
+
+	case VIDIOC_QBUF:
+		buffer = arg;
+
+		if (buffer->type == V4L2_BUF_TYPE_VIDEO_OUTPUT) {
+			if (mock.reject_output_queue) {
+				errno = EINVAL;
+				return -1;
+			}
+
+			mock.output_queued_count++;
+		} else {
+			mock.capture_queued_count++;
+		}
+
+		return 0;
+
+	case VIDIOC_STREAMOFF:
+		if (*(int *)arg == V4L2_BUF_TYPE_VIDEO_CAPTURE)
+			mock.capture_streamoff_count++;
+
+		return 0;
+
+	case MEDIA_REQUEST_IOC_QUEUE:
+		if (mock.reject_request_queue) {
+			errno = ENOENT;
+			return -1;
+		}
+
+		return 0;
+
+	default:
+		return 0;
+	}
+}
+
+static struct video_format video_format = {
+	.description = "mock",
+	.v4l2_mplane = false,
+	.planes_count = 2,
+};
+
+#define SOURCE_BUFFERS_COUNT	4
+
+static struct request_data driver_data;
+static struct VADriverContext va_context;
+static VAContextID context_id;
+static VAConfigID config_id;
+
+static VASurfaceID surface_create(void)
+{
+	struct object_surface *surface_object;
+	VASurfaceID id;
+
+	id = object_heap_allocate(&driver_data.surface_heap);
+	surface_object = SURFACE(&driver_data, id);
+
+	memset((char *)surface_object + sizeof(surface_object->base), 0,
+	       sizeof(*surface_object) - sizeof(surface_object->base));
+
+	surface_object->status = VASurfaceReady;
+	surface_object->source_buffer = -1;
+	surface_object->slices_buffer = -1;
+	surface_object->destination_buffers_count = 1;
+	surface_object->request_fd = -1;
+	surface_object->context_id = VA_INVALID_ID;
+
+	surface_object->params.mpeg2.picture.forward_reference_picture =
+		VA_INVALID_SURFACE;
+	surface_object->params.mpeg2.picture.backward_reference_picture =
+		VA_INVALID_SURFACE;
+	surface_object->params.mpeg2.iqmatrix.load_intra_quantiser_matrix = 1;
+	surface_object->params.mpeg2.iqmatrix.intra_quantiser_matrix[0] = 8;
+	surface_object->params.mpeg2.iqmatrix_set = true;
+
+	surface_object->slices_params =
+		calloc(1, sizeof(VASliceParameterBufferMPEG2));
+	surface_object->slices_params_size =
+		sizeof(VASliceParameterBufferMPEG2);
+
+	return id;
+}
+
+static int setup(void)
+{
+	struct object_config *config_object;
+	struct object_context *context_object;
+	unsigned int i;
+	int fd;
+
+	object_heap_init(&driver_data.config_heap,
+			 sizeof(struct object_config), CONFIG_ID_OFFSET);
+	object_heap_init(&driver_data.context_heap,
+			 sizeof(struct object_context), CONTEXT_ID_OFFSET);
+	object_heap_init(&driver_data.surface_heap,
+			 sizeof(struct object_surface), SURFACE_ID_OFFSET);
+
+	pthread_mutex_init(&driver_data.mutex, NULL);
+	pthread_cond_init(&driver_data.cond, NULL);
+
+	driver_data.video_fd = -1;
+	driver_data.media_fd = -1;
+	driver_data.dma_heap_fd = -1;
+	driver_data.video_format = &video_format;
+
+	driver_data.controls[0].id = V4L2_CID_MPEG_VIDEO_MPEG2_SLICE_PARAMS;
+	driver_data.controls[0].supported = true;
+	driver_data.controls[1].id = V4L2_CID_MPEG_VIDEO_MPEG2_QUANTIZATION;
+	driver_data.controls[1].supported = true;
+	driver_data.controls_count = 2;
+
+	driver_data.waiter_fd = media_waiter_create();
+	if (driver_data.waiter_fd < 0)
+		return -1;
+
+	/* Event file descriptors can be watched like media requests. */
+	while (driver_data.request_pool.count < MEDIA_REQUEST_POOL_SIZE) {
+		fd = eventfd(0, EFD_CLOEXEC);
+		if (fd < 0)
+			return -1;
+
+		media_request_pool_put(&driver_data.request_pool, fd);
+	}
+
+	va_context.pDriverData = &driver_data;
+
+	config_id = object_heap_allocate(&driver_data.config_heap);
+	config_object = CONFIG(&driver_data, config_id);
+	config_object->profile = VAProfileMPEG2Main;
+
+	context_id = object_heap_allocate(&driver_data.context_heap);
+	context_object = CONTEXT(&driver_data, context_id);
+
+	memset((char *)context_object + sizeof(context_object->base), 0,
+	       sizeof(*context_object) - sizeof(context_object->base));
+
+	context_object->config_id = config_id;
+	context_object->queue_depth = 4;
+	context_object->slice_pending = -1;
+	context_object->slice_carved = -1;
+	context_object->slice_params_max = 1;
+
+	context_object->source_buffers =
+		calloc(SOURCE_BUFFERS_COUNT,
+		       sizeof(*context_object->source_buffers));
+	if (context_object->source_buffers == NULL)
+		return -1;
+
+	for (i = 0; i < SOURCE_BUFFERS_COUNT; i++) {
+		context_object->source_buffers[i].index = i;
+		context_object->source_buffers[i].fd = -1;
+		context_object->source_buffers[i].request_fd = -1;
+		context_object->source_buffers[i].surface_id = VA_INVALID_ID;
+	}
+
+	context_object->source_buffers_count = SOURCE_BUFFERS_COUNT;
+
+	ref_manager_init(&context_object->refs, &driver_data.surface_heap,
+			 NULL, 0);
+
+	return 0;
+}
+
+/* Renders a picture made of a single slice, as RenderPicture would. */
+static VAStatus decode_picture(VASurfaceID surface_id, unsigned int size)
+{
+	struct object_surface *surface_object =
+		SURFACE(&driver_data, surface_id);
+	VAStatus status;
+
+	status = RequestBeginPicture(&va_context, context_id, surface_id);
+	if (status != VA_STATUS_SUCCESS)
+		return status;
+
+	surface_object->slices_count++;
+	surface_object->slices_size += size;
+
+	return RequestEndPicture(&va_context, context_id);
+}
+
+#define CHECK(condition)						\
+	do {								\
+		if (!(condition)) {					\
+			fprintf(stderr, "%s:%d: check failed: %s\n",	\
+				__FILE__, __LINE__, #condition);	\
+			return 1;					\
+		}							\
+	} while (0)
+
+static bool source_dequeued(VASurfaceID surface_id)
+{
+	struct object_surface *surface_object =
+		SURFACE(&driver_data, surface_id);
+
+	return driver_data.output_dequeued[surface_object->source_index];
+}
+
+/* A failed picture gives its request back and leaves the surface usable. */
+static int check_failed(VASurfaceID surface_id)
+{
+	struct object_surface *surface_object =
+		SURFACE(&driver_data, surface_id);
+
+	CHECK(surface_object->request_fd < 0);
+	CHECK(driver_data.request_pool.count == MEDIA_REQUEST_POOL_SIZE);
+	CHECK(surface_object->status != VASurfaceRendering);
+	CHECK(surface_object->slices_submitted == 0);
+	CHECK(surface_object->output_index == VIDEO_MAX_FRAME);
+	CHECK(CONTEXT(&driver_data, context_id)->controls_cache_count == 0);
+
+	return 0;
+}
+
+int main(void)
+{
+	VASurfaceID surface_id;
+	VAStatus status;
+
+	CHECK(setup() == 0);
+
+	surface_id = surface_create();
+
+	/* A rejected quantization control fails the picture. */
+	mock.reject_control_id = V4L2_CID_MPEG_VIDEO_MPEG2_QUANTIZATION;
+
+	status = decode_picture(surface_id, 16);
+	CHECK(status != VA_STATUS_SUCCESS);
+	CHECK(mock.set_controls_count == 1);
+	CHECK(mock.set_controls_last_count == 2);
+	CHECK(mock.output_queued_count == 0);
+	CHECK(mock.capture_queued_count == 0);
+	CHECK(check_failed(surface_id) == 0);
+
+	mock.reject_control_id = 0;
+
+	/* So does the OUTPUT buffer failing to be queued. */
+	mock.reject_output_queue = true;
+
+	status = decode_picture(surface_id, 16);
+	CHECK(status != VA_STATUS_SUCCESS);
+	CHECK(mock.capture_queued_count == 0);
+	CHECK(source_dequeued(surface_id));
+	CHECK(check_failed(surface_id) == 0);
+
+	mock.reject_output_queue = false;
+
+	/* The capture buffer queued before the request is taken back. */
+	mock.reject_request_queue = true;
+
+	status = decode_picture(surface_id, 16);
+	CHECK(status != VA_STATUS_SUCCESS);
+	CHECK(mock.output_queued_count == 1);
+	CHECK(mock.capture_queued_count == 1);
+	CHECK(mock.capture_streamoff_count == 1);
+	CHECK(source_dequeued(surface_id));
+	CHECK(check_failed(surface_id) == 0);
+
+	mock.reject_request_queue = false;
+
+	/*
+	 * The matrices that were never applied are sent again, and nothing
+	 * is left of the slices of the pictures that failed.
+	 */
+	mock.set_controls_count = 0;
+
+	status = decode_picture(surface_id, 8);
+	CHECK(status == VA_STATUS_SUCCESS);
+	CHECK(mock.slice_bit_size == 8 * 8);
+	CHECK(mock.set_controls_count == 1);
+	CHECK(mock.set_controls_last_count == 2);
+	CHECK(mock.output_queued_count == 2);
+	CHECK(mock.capture_queued_count == 2);
+	CHECK(SURFACE(&driver_data, surface_id)->request_queued);
+
+	/* Unchanged matrices are then carried over by the kernel. */
+	surface_id = surface_create();
+
+	status = decode_picture(surface_id, 16);
+	CHECK(status == VA_STATUS_SUCCESS);
+	CHECK(mock.set_controls_count == 2);
+	CHECK(mock.set_controls_last_count == 1);
+
+	printf("end_picture: ok\n");
+
+	return 0;
+}
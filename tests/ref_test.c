@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2019 Bootlin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks that the reference table of a context resolves the timestamps of its
+ * render targets and lets go of the surfaces that get destroyed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "context.h"
+#include "ref.h"
+#include "request.h"
+#include "surface.h"
+
+#define CHECK(condition)						\
+	do {								\
+		if (!(condition)) {					\
+			fprintf(stderr, "%s:%d: check failed: %s\n",	\
+				__FILE__, __LINE__, #condition);	\
+			return 1;					\
+		}							\
+	} while (0)
+
+static struct request_data driver_data;
+static struct VADriverContext va_context;
+
+static VASurfaceID surface_create(unsigned int sequence)
+{
+	struct object_surface *surface_object;
+	VASurfaceID id;
+
+	id = object_heap_allocate(&driver_data.surface_heap);
+	surface_object = SURFACE(&driver_data, id);
+
+	memset((char *)surface_object + sizeof(surface_object->base), 0,
+	       sizeof(*surface_object) - sizeof(surface_object->base));
+
+	surface_object->status = VASurfaceReady;
+	surface_object->request_fd = -1;
+	surface_object->timestamp.tv_usec = sequence;
+
+	return id;
+}
+
+int main(void)
+{
+	struct object_context *context_object;
+	struct object_surface *surface_object;
+	VASurfaceID surfaces_ids[3];
+	VASurfaceID other_id;
+	VAContextID context_id;
+	uint64_t timestamp;
+	unsigned int i;
+
+	object_heap_init(&driver_data.context_heap,
+			 sizeof(struct object_context), CONTEXT_ID_OFFSET);
+	object_heap_init(&driver_data.surface_heap,
+			 sizeof(struct object_surface), SURFACE_ID_OFFSET);
+
+	va_context.pDriverData = &driver_data;
+
+	for (i = 0; i < 3; i++)
+		surfaces_ids[i] = surface_create(i + 1);
+
+	other_id = surface_create(10);
+
+	context_id = object_heap_allocate(&driver_data.context_heap);
+	context_object = CONTEXT(&driver_data, context_id);
+
+	CHECK(ref_manager_init(&context_object->refs,
+			       &driver_data.surface_heap, surfaces_ids,
+			       3) == 0);
+
+	for (i = 0; i < 3; i++) {
+		surface_object = SURFACE(&driver_data, surfaces_ids[i]);
+		CHECK(surface_object->refs_count == 1);
+
+		CHECK(ref_timestamp(&context_object->refs, surfaces_ids[i],
+				    &timestamp));
+		CHECK(timestamp == (i + 1) * 1000ULL);
+	}
+
+	/* Surfaces that are not render targets are looked up in the heap. */
+	CHECK(ref_lookup(&context_object->refs, other_id) == NULL);
+	CHECK(ref_timestamp(&context_object->refs, other_id, &timestamp));
+	CHECK(timestamp == 10 * 1000ULL);
+
+	CHECK(!ref_timestamp(&context_object->refs, VA_INVALID_SURFACE,
+			     &timestamp));
+
+	/* A destroyed render target is no longer resolved. */
+	CHECK(RequestDestroySurfaces(&va_context, &surfaces_ids[1], 1) ==
+	      VA_STATUS_SUCCESS);
+
+	CHECK(ref_lookup(&context_object->refs, surfaces_ids[1]) == NULL);
+	CHECK(!ref_timestamp(&context_object->refs, surfaces_ids[1],
+			     &timestamp));
+	CHECK(ref_timestamp(&context_object->refs, surfaces_ids[2],
+			    &timestamp));
+
+	ref_manager_cleanup(&context_object->refs);
+
+	CHECK(SURFACE(&driver_data, surfaces_ids[0])->refs_count == 0);
+	CHECK(SURFACE(&driver_data, surfaces_ids[2])->refs_count == 0);
+
+	printf("ref: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2019 Bootlin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks that every conversion variant the CPU supports is bit-exact with
+ * the portable one, including the bytes past the width that must be left
+ * untouched.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tiled_yuv.h"
+
+#define TILE_WIDTH	32
+#define TILE_HEIGHT	32
+#define TILE_SIZE	(TILE_WIDTH * TILE_HEIGHT)
+
+#define PADDING_BYTE	0xa5
+
+static const unsigned int widths[] = { 1, 2, 17, 31, 32, 33, 62, 64, 100, 257 };
+static const unsigned int heights[] = { 1, 15, 32, 33, 70 };
+static const unsigned int pitch_extras[] = { 0, 1, 13, 40 };
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+static unsigned int tiled_size(unsigned int width, unsigned int height)
+{
+	unsigned int tiles_x = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+	unsigned int tiles_y = (height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+
+	return tiles_x * tiles_y * TILE_SIZE;
+}
+
+static int check_variant(const struct tiled_yuv_impl *reference,
+			 const struct tiled_yuv_impl *impl, uint8_t *src,
+			 unsigned int width, unsigned int height,
+			 unsigned int pitch)
+{
+	unsigned int size = pitch * height;
+	uint8_t *expected, *result;
+	int ret = 0;
+
+	expected = malloc(size * 2);
+	result = malloc(size * 2);
+	if (expected == NULL || result == NULL) {
+		fprintf(stderr, "Unable to allocate destination buffers\n");
+		ret = -1;
+		goto complete;
+	}
+
+	memset(expected, PADDING_BYTE, size);
+	memset(result, PADDING_BYTE, size);
+
+	reference->to_planar(src, expected, pitch, width, height);
+	impl->to_planar(src, result, pitch, width, height);
+
+	if (memcmp(expected, result, size) != 0) {
+		fprintf(stderr, "%s: tiled_to_planar mismatch for %ux%u, pitch %u\n",
+			impl->name, width, height, pitch);
+		ret = -1;
+	}
+
+	memset(expected, PADDING_BYTE, size * 2);
+	memset(result, PADDING_BYTE, size * 2);
+
+	reference->deinterleave_to_planar(src, expected, expected + size,
+					  pitch, width, height);
+	impl->deinterleave_to_planar(src, result, result + size, pitch, width,
+				     height);
+
+	if (memcmp(expected, result, size * 2) != 0) {
+		fprintf(stderr, "%s: tiled_deinterleave_to_planar mismatch for %ux%u, pitch %u\n",
+			impl->name, width, height, pitch);
+		ret = -1;
+	}
+
+complete:
+	free(expected);
+	free(result);
+
+	return ret;
+}
+
+int main(void)
+{
+	const struct tiled_yuv_impl *reference = NULL;
+	const struct tiled_yuv_impl *impl;
+	unsigned int width, height, pitch, size;
+	unsigned int i, j, k, n;
+	uint8_t *src;
+	bool failed;
+	int ret = 0;
+
+	for (impl = tiled_yuv_impls; impl->name != NULL; impl++)
+		if (strcmp(impl->name, "c") == 0)
+			reference = impl;
+
+	if (reference == NULL) {
+		fprintf(stderr, "Missing portable variant\n");
+		return 1;
+	}
+
+	srand(0);
+
+	for (impl = tiled_yuv_impls; impl->name != NULL; impl++) {
+		if (impl == reference)
+			continue;
+
+		if (!impl->supported()) {
+			printf("%s: not supported, skipped\n", impl->name);
+			continue;
+		}
+
+		failed = false;
+
+		for (i = 0; i < ARRAY_SIZE(widths); i++) {
+			for (j = 0; j < ARRAY_SIZE(heights); j++) {
+				width = widths[i];
+				height = heights[j];
+				size = tiled_size(width, height);
+
+				src = malloc(size);
+				if (src == NULL)
+					return 1;
+
+				for (n = 0; n < size; n++)
+					src[n] = rand();
+
+				for (k = 0; k < ARRAY_SIZE(pitch_extras); k++) {
+					pitch = width + pitch_extras[k];
+
+					if (check_variant(reference, impl, src,
+							  width, height,
+							  pitch) < 0)
+						failed = true;
+				}
+
+				free(src);
+			}
+		}
+
+		printf("%s: %s\n", impl->name, failed ? "FAIL" : "ok");
+
+		if (failed)
+			ret = 1;
+	}
+
+	return ret;
+}